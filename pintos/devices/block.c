@@ -4,6 +4,13 @@
 #include <stdio.h>
 #include "devices/ide.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#ifdef FILESYS
+#include "filesys/cache.h"
+#endif
 
 /* A block device. */
 struct block
@@ -19,6 +26,32 @@ struct block
 
     unsigned long long read_cnt;        /* Number of sectors read. */
     unsigned long long write_cnt;       /* Number of sectors written. */
+    unsigned long long request_cnt;     /* 读写请求数，一次请求可传输多个扇区 */
+
+    /* 异步请求队列，由dispatcher->lock保护。 */
+    struct block_dispatcher *dispatcher; /* 调度线程，NULL表示同步执行 */
+    struct list_elem dispatch_elem;     /* Element in dispatcher's blocks. */
+    struct list queue;                  /* 待处理请求，按扇区号排序 */
+    block_sector_t head;                /* 上次传输结束的扇区，C-LOOK从这里继续 */
+    size_t depth;                       /* 队列中的请求数 */
+    size_t max_depth;                   /* 队列最大长度 */
+    unsigned long long depth_sum;       /* 每次提交后的队列长度之和 */
+    unsigned long long submit_cnt;      /* 提交的请求数 */
+    unsigned long long merge_cnt;       /* 合并到其他请求中一起传输的请求数 */
+  };
+
+/* Most sectors that one merged transfer may cover. */
+#define MERGE_PAGES 8
+#define MERGE_MAX (MERGE_PAGES * PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* A dispatcher: a thread that carries out the requests queued
+   on a group of block devices, one transfer at a time. */
+struct block_dispatcher
+  {
+    struct lock lock;                   /* Protects the blocks' queues. */
+    struct condition work;              /* Signaled when a request arrives. */
+    struct list blocks;                 /* Blocks served, round-robin. */
+    uint8_t *buffer;                    /* MERGE_MAX sectors for merging. */
   };
 
 /* List of all block devices. */
@@ -28,6 +61,12 @@ static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 static struct block *block_by_role[BLOCK_ROLE_CNT];
 
 static struct block *list_elem_to_block (struct list_elem *);
+static void submit_and_wait (struct block *, bool write, block_sector_t,
+                             size_t cnt, void *buffer);
+static void transfer (struct block *, bool write, block_sector_t,
+                      size_t cnt, void *buffer);
+static list_less_func sector_less;
+static thread_func dispatcher_thread;
 
 /* Returns a human-readable name for the given block device
    TYPE. */
@@ -113,6 +152,15 @@ check_sector (struct block *block, block_sector_t sector)
     }
 }
 
+/* 检查从SECTOR开始的CNT个扇区都在BLOCK之内，否则panic。 */
+static void
+check_sectors (struct block *block, block_sector_t sector, size_t cnt)
+{
+  ASSERT (cnt > 0);
+  check_sector (block, sector);
+  check_sector (block, sector + cnt - 1);
+}
+
 /* Reads sector SECTOR from BLOCK into BUFFER, which must
    have room for BLOCK_SECTOR_SIZE bytes.
    Internally synchronizes accesses to block devices, so external
@@ -121,8 +169,7 @@ void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
   check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  submit_and_wait (block, false, sector, 1, buffer);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -135,8 +182,127 @@ block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
   check_sector (block, sector);
   ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  submit_and_wait (block, true, sector, 1, (void *) buffer);
+}
+
+/* Reads the CNT sectors starting at SECTOR from BLOCK into
+   BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes.  Devices that can do so transfer all of them with a few
+   multi-sector requests instead of one request per sector. */
+void
+block_read_multi (struct block *block, block_sector_t sector, size_t cnt,
+                  void *buffer)
+{
+  check_sectors (block, sector, cnt);
+  submit_and_wait (block, false, sector, cnt, buffer);
+}
+
+/* Writes the CNT sectors starting at SECTOR to BLOCK from
+   BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Returns after the block device has acknowledged receiving all
+   of the data.  Like block_read_multi(), uses multi-sector
+   requests when the device supports them. */
+void
+block_write_multi (struct block *block, block_sector_t sector, size_t cnt,
+                   const void *buffer)
+{
+  check_sectors (block, sector, cnt);
+  ASSERT (block->type != BLOCK_FOREIGN);
+  submit_and_wait (block, true, sector, cnt, (void *) buffer);
+}
+
+/* Initializes request R to read (if WRITE is false) or write
+   (if WRITE is true) the CNT sectors starting at SECTOR, using
+   BUFFER, and to call DONE with AUX when it completes.  DONE may
+   be null. */
+void
+block_request_init (struct block_request *r, bool write,
+                    block_sector_t sector, size_t cnt, void *buffer,
+                    block_done_func *done, void *aux)
+{
+  r->write = write;
+  r->sector = sector;
+  r->cnt = cnt;
+  r->buffer = buffer;
+  r->done = done;
+  r->aux = aux;
+  r->seq = 0;
+}
+
+/* Queues request R on BLOCK and returns without waiting for it.
+   R's done function is called when the transfer is complete.
+   Requests are not necessarily carried out in the order they
+   are submitted, except that a request is never started before
+   an earlier request to an overlapping range of sectors. */
+void
+block_submit (struct block *block, struct block_request *r)
+{
+  struct block_dispatcher *d = block->dispatcher;
+
+  check_sectors (block, r->sector, r->cnt);
+  ASSERT (!r->write || block->type != BLOCK_FOREIGN);
+
+  if (d == NULL)
+    {
+      /* 没有调度线程，直接在当前线程完成请求。 */
+      block->submit_cnt++;
+      transfer (block, r->write, r->sector, r->cnt, r->buffer);
+      if (r->done != NULL)
+        r->done (r, r->aux);
+      return;
+    }
+
+  lock_acquire (&d->lock);
+  r->seq = block->submit_cnt++;
+  list_insert_ordered (&block->queue, &r->elem, sector_less, NULL);
+  if (++block->depth > block->max_depth)
+    block->max_depth = block->depth;
+  block->depth_sum += block->depth;
+  cond_signal (&d->work, &d->lock);
+  lock_release (&d->lock);
+}
+
+/* Creates a dispatcher with its own thread, named NAME, that
+   carries out the requests queued on the devices assigned to it
+   with block_set_dispatcher().  Panics on failure. */
+struct block_dispatcher *
+block_dispatcher_create (const char *name)
+{
+  struct block_dispatcher *d = malloc (sizeof *d);
+  if (d == NULL)
+    PANIC ("Failed to allocate memory for block dispatcher");
+
+  lock_init (&d->lock);
+  cond_init (&d->work);
+  list_init (&d->blocks);
+  d->buffer = palloc_get_multiple (PAL_ASSERT, MERGE_PAGES);
+  if (thread_create (name, PRI_DEFAULT, dispatcher_thread, d) == TID_ERROR)
+    PANIC ("Failed to create block dispatcher thread");
+  return d;
+}
+
+/* Assigns BLOCK to dispatcher D, which from now on carries out
+   all of BLOCK's requests.  Must be called before any request is
+   submitted to BLOCK. */
+void
+block_set_dispatcher (struct block *block, struct block_dispatcher *d)
+{
+  ASSERT (block->dispatcher == NULL);
+  ASSERT (d != NULL);
+
+  block->dispatcher = d;
+  lock_acquire (&d->lock);
+  list_push_back (&d->blocks, &block->dispatch_elem);
+  lock_release (&d->lock);
+}
+
+/* Returns the dispatcher serving BLOCK, or a null pointer if
+   BLOCK's requests are carried out by the threads that submit
+   them. */
+struct block_dispatcher *
+block_get_dispatcher (struct block *block)
+{
+  return block->dispatcher;
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -166,16 +332,26 @@ block_print_stats (void)
 {
   int i;
 
-  for (i = 0; i < BLOCK_CNT; i++)
+  for (i = 0; i < BLOCK_ROLE_CNT; i++)
     {
       struct block *block = block_by_role[i];
       if (block != NULL)
         {
-          printf ("%s (%s): %llu reads, %llu writes\n",
+          printf ("%s (%s): %llu reads, %llu writes, %llu requests\n",
                   block->name, block_type_name (block->type),
-                  block->read_cnt, block->write_cnt);
+                  block->read_cnt, block->write_cnt, block->request_cnt);
+          if (block->submit_cnt > 0)
+            printf ("%s: %llu submitted, %llu merged, "
+                    "queue depth %zu max, %llu.%02llu average\n",
+                    block->name, block->submit_cnt, block->merge_cnt,
+                    block->max_depth,
+                    block->depth_sum / block->submit_cnt,
+                    block->depth_sum * 100 / block->submit_cnt % 100);
         }
     }
+#ifdef FILESYS
+  cache_print_stats ();
+#endif
 }
 
 /* Registers a new block device with the given NAME.  If
@@ -200,6 +376,15 @@ block_register (const char *name, enum block_type type,
   block->aux = aux;
   block->read_cnt = 0;
   block->write_cnt = 0;
+  block->request_cnt = 0;
+  block->dispatcher = NULL;
+  list_init (&block->queue);
+  block->head = 0;
+  block->depth = 0;
+  block->max_depth = 0;
+  block->depth_sum = 0;
+  block->submit_cnt = 0;
+  block->merge_cnt = 0;
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
@@ -221,3 +406,221 @@ list_elem_to_block (struct list_elem *list_elem)
           : NULL);
 }
 
+
+/* 调用驱动传输从SECTOR开始的CNT个扇区，并更新统计。 */
+static void
+transfer (struct block *block, bool write, block_sector_t sector,
+          size_t cnt, void *buffer_)
+{
+  uint8_t *buffer = buffer_;
+  size_t i;
+
+  if (write ? block->ops->write_multi != NULL
+            : block->ops->read_multi != NULL)
+    {
+      if (write)
+        block->ops->write_multi (block->aux, sector, cnt, buffer);
+      else
+        block->ops->read_multi (block->aux, sector, cnt, buffer);
+      block->request_cnt++;
+    }
+  else
+    for (i = 0; i < cnt; i++)
+      {
+        if (write)
+          block->ops->write (block->aux, sector + i,
+                             buffer + i * BLOCK_SECTOR_SIZE);
+        else
+          block->ops->read (block->aux, sector + i,
+                            buffer + i * BLOCK_SECTOR_SIZE);
+        block->request_cnt++;
+      }
+
+  if (write)
+    block->write_cnt += cnt;
+  else
+    block->read_cnt += cnt;
+}
+
+/* block_submit()的完成回调：唤醒等待的线程。 */
+static void
+wake_up (struct block_request *r UNUSED, void *done)
+{
+  sema_up (done);
+}
+
+/* 提交一个请求并等待它完成，用于同步接口。 */
+static void
+submit_and_wait (struct block *block, bool write, block_sector_t sector,
+                 size_t cnt, void *buffer)
+{
+  struct block_request r;
+  struct semaphore done;
+
+  sema_init (&done, 0);
+  block_request_init (&r, write, sector, cnt, buffer, wake_up, &done);
+  block_submit (block, &r);
+  sema_down (&done);
+}
+
+/* 按起始扇区排序请求。扇区相同的按提交顺序。 */
+static bool
+sector_less (const struct list_elem *a_, const struct list_elem *b_,
+             void *aux UNUSED)
+{
+  const struct block_request *a = list_entry (a_, struct block_request, elem);
+  const struct block_request *b = list_entry (b_, struct block_request, elem);
+  return a->sector < b->sector;
+}
+
+/* 返回两个请求的扇区范围是否重叠。 */
+static bool
+overlaps (const struct block_request *a, const struct block_request *b)
+{
+  return a->sector < b->sector + b->cnt && b->sector < a->sector + a->cnt;
+}
+
+/* 返回BLOCK队列中比R更早提交、且与R重叠的请求，没有则返回NULL。
+   R必须等这样的请求完成后才能开始。 */
+static struct block_request *
+find_conflict (struct block *block, struct block_request *r)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&block->queue); e != list_end (&block->queue);
+       e = list_next (e))
+    {
+      struct block_request *q = list_entry (e, struct block_request, elem);
+      if (q->seq < r->seq && overlaps (q, r))
+        return q;
+    }
+  return NULL;
+}
+
+/* 按C-LOOK选择BLOCK的下一个请求：扇区号不小于磁头位置的第一个
+   请求，没有则回到最小扇区。若它依赖更早的重叠请求，改选那个。 */
+static struct block_request *
+pick_request (struct block *block)
+{
+  struct block_request *r, *q;
+  struct list_elem *e;
+
+  for (e = list_begin (&block->queue); e != list_end (&block->queue);
+       e = list_next (e))
+    if (list_entry (e, struct block_request, elem)->sector >= block->head)
+      break;
+  if (e == list_end (&block->queue))
+    e = list_begin (&block->queue);
+
+  r = list_entry (e, struct block_request, elem);
+  while ((q = find_conflict (block, r)) != NULL)
+    r = q;
+  return r;
+}
+
+/* 从BLOCK的队列中取出下一个请求，以及紧随其后、方向相同且扇区
+   相邻的请求，放入BATCH，总数不超过MERGE_MAX个扇区。
+   返回这批请求覆盖的扇区数。调用者必须持有调度器的锁。 */
+static size_t
+take_batch (struct block *block, struct list *batch)
+{
+  struct block_request *first = pick_request (block);
+  block_sector_t end = first->sector + first->cnt;
+  struct list_elem *e = list_remove (&first->elem);
+
+  list_push_back (batch, &first->elem);
+  block->depth--;
+  while (e != list_end (&block->queue))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      if (r->sector != end || r->write != first->write
+          || end - first->sector + r->cnt > MERGE_MAX
+          || find_conflict (block, r) != NULL)
+        break;
+      e = list_remove (&r->elem);
+      list_push_back (batch, &r->elem);
+      block->depth--;
+      block->merge_cnt++;
+      end += r->cnt;
+    }
+  block->head = end;
+  return end - first->sector;
+}
+
+/* 轮流返回调度器D中下一个有待处理请求的设备，都没有则返回NULL。
+   调用者必须持有D的锁。 */
+static struct block *
+next_block (struct block_dispatcher *d)
+{
+  size_t n = list_size (&d->blocks);
+
+  while (n-- > 0)
+    {
+      struct list_elem *e = list_pop_front (&d->blocks);
+      struct block *block = list_entry (e, struct block, dispatch_elem);
+      list_push_back (&d->blocks, e);
+      if (!list_empty (&block->queue))
+        return block;
+    }
+  return NULL;
+}
+
+/* 调度线程：反复取出一批相邻请求，用一次传输完成，再调用各请求
+   的完成回调。多个请求合并时经由D->buffer中转。 */
+static void
+dispatcher_thread (void *d_)
+{
+  struct block_dispatcher *d = d_;
+
+  for (;;)
+    {
+      struct block_request *first;
+      struct block *block;
+      struct list batch;
+      struct list_elem *e;
+      size_t cnt;
+      uint8_t *p;
+
+      lock_acquire (&d->lock);
+      while ((block = next_block (d)) == NULL)
+        cond_wait (&d->work, &d->lock);
+      list_init (&batch);
+      cnt = take_batch (block, &batch);
+      lock_release (&d->lock);
+
+      first = list_entry (list_front (&batch), struct block_request, elem);
+      if (list_next (&first->elem) == list_end (&batch))
+        transfer (block, first->write, first->sector, cnt, first->buffer);
+      else
+        {
+          if (first->write)
+            for (e = list_begin (&batch), p = d->buffer;
+                 e != list_end (&batch); e = list_next (e))
+              {
+                struct block_request *r
+                  = list_entry (e, struct block_request, elem);
+                memcpy (p, r->buffer, r->cnt * BLOCK_SECTOR_SIZE);
+                p += r->cnt * BLOCK_SECTOR_SIZE;
+              }
+          transfer (block, first->write, first->sector, cnt, d->buffer);
+          if (!first->write)
+            for (e = list_begin (&batch), p = d->buffer;
+                 e != list_end (&batch); e = list_next (e))
+              {
+                struct block_request *r
+                  = list_entry (e, struct block_request, elem);
+                memcpy (r->buffer, p, r->cnt * BLOCK_SECTOR_SIZE);
+                p += r->cnt * BLOCK_SECTOR_SIZE;
+              }
+        }
+
+      /* 回调可能立即重用请求，所以先从BATCH中取出。 */
+      while (!list_empty (&batch))
+        {
+          struct block_request *r
+            = list_entry (list_pop_front (&batch), struct block_request, elem);
+          if (r->done != NULL)
+            r->done (r, r->aux);
+        }
+    }
+}
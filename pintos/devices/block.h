@@ -1,8 +1,10 @@
 #ifndef DEVICES_BLOCK_H
 #define DEVICES_BLOCK_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <inttypes.h>
+#include <list.h>
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -53,9 +55,52 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multi (struct block *, block_sector_t, size_t cnt, void *);
+void block_write_multi (struct block *, block_sector_t, size_t cnt,
+                        const void *);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
+/* Asynchronous requests.
+
+   A request is queued on its block device and later carried out
+   by the dispatcher thread that serves the device, which calls
+   the request's DONE function, if any, once the transfer is
+   complete.  DONE runs in the dispatcher thread, so it should
+   not sleep for long and must not wait for another request to
+   the same dispatcher.  The caller owns the request and must
+   not touch it again until DONE has been called. */
+struct block_request;
+typedef void block_done_func (struct block_request *, void *aux);
+
+struct block_request
+  {
+    struct list_elem elem;      /* Element in the device's queue. */
+    bool write;                 /* Write (true) or read (false)? */
+    block_sector_t sector;      /* First sector. */
+    size_t cnt;                 /* Number of sectors. */
+    void *buffer;               /* CNT * BLOCK_SECTOR_SIZE bytes. */
+    block_done_func *done;      /* Called when complete, or null. */
+    void *aux;                  /* Passed to DONE. */
+    unsigned long long seq;     /* Submission order, set by block layer. */
+  };
+
+void block_request_init (struct block_request *, bool write,
+                         block_sector_t, size_t cnt, void *buffer,
+                         block_done_func *, void *aux);
+void block_submit (struct block *, struct block_request *);
+
+/* Dispatchers.  Devices sharing a dispatcher, e.g. the disks on
+   one IDE channel, are served one request at a time by a single
+   thread.  A device without a dispatcher, such as a partition,
+   carries out each request in the submitting thread; a device
+   whose driver itself submits requests to other devices must not
+   have one, or the dispatcher would wait on itself. */
+struct block_dispatcher;
+struct block_dispatcher *block_dispatcher_create (const char *name);
+void block_set_dispatcher (struct block *, struct block_dispatcher *);
+struct block_dispatcher *block_get_dispatcher (struct block *);
+
 /* Statistics. */
 void block_print_stats (void);
 
@@ -65,6 +110,14 @@ struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+
+    /* Transfer CNT consecutive sectors in as few requests as the
+       device allows.  May be null, in which case the block layer
+       transfers one sector at a time. */
+    void (*read_multi) (void *aux, block_sector_t, size_t cnt,
+                        void *buffer);
+    void (*write_multi) (void *aux, block_sector_t, size_t cnt,
+                         const void *buffer);
   };
 
 struct block *block_register (const char *name, enum block_type,
@@ -8,10 +8,20 @@
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
-   controller.  It attempts to comply to [ATA-3]. */
+   controller.  It attempts to comply to [ATA-3].
+
+   If a PCI IDE controller with bus-master DMA support is found,
+   such as the PIIX that QEMU emulates, sectors are transferred
+   with READ DMA and WRITE DMA: the controller copies the data
+   between the disk and memory on its own while the calling
+   thread waits on completion_wait, so the CPU is free to run
+   other threads.  Otherwise, and for disks that do not support
+   DMA, the CPU moves every word in PIO mode. */
 
 /* ATA command block port addresses. */
 #define reg_data(CHANNEL) ((CHANNEL)->reg_base + 0)     /* Data. */
@@ -30,10 +40,27 @@
 #define reg_ctl(CHANNEL) ((CHANNEL)->reg_base + 0x206)  /* Control (w/o). */
 #define reg_alt_status(CHANNEL) reg_ctl (CHANNEL)       /* Alt Status (r/o). */
 
+/* Bus-master IDE port addresses, relative to the channel's slice
+   of the controller's BAR4 I/O space. */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0)  /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)   /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)     /* PRDT address. */
+
+/* Bus-master Command Register bits. */
+#define BM_CMD_START 0x01       /* Start transfer. */
+#define BM_CMD_READ 0x08        /* Transfer from disk to memory. */
+
+/* Bus-master Status Register bits.  ERR and IRQ are cleared by
+   writing 1 to them. */
+#define BM_STA_ACTIVE 0x01      /* Transfer in progress. */
+#define BM_STA_ERR 0x02         /* Error. */
+#define BM_STA_IRQ 0x04         /* Interrupt raised. */
+
 /* Alternate Status Register bits. */
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +76,15 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4          /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5         /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6      /* SET MULTIPLE MODE. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+
+/* Most sectors one READ or WRITE command can transfer: a sector
+   count of 0 in the Sector Count register means 256. */
+#define MAX_TRANSFER 256
 
 /* An ATA device. */
 struct ata_disk
@@ -57,8 +93,24 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    int multiple;               /* READ/WRITE MULTIPLE每次中断传输的扇区数，
+                                   0表示不使用 */
+    bool dma;                   /* 是否用总线主控DMA传输 */
+  };
+
+/* A physical region descriptor: one physically contiguous piece
+   of a DMA transfer's buffer.  A region may not cross a 64 kB
+   boundary. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address. */
+    uint16_t size;              /* Size in bytes, 0 meaning 64 kB. */
+    uint16_t flags;             /* PRD_EOT on the last region. */
   };
 
+#define PRD_EOT 0x8000          /* End of table. */
+#define PRD_BOUNDARY 0x10000    /* Regions may not cross this. */
+
 /* An ATA channel (aka controller).
    Each channel can control up to two disks. */
 struct channel
@@ -72,6 +124,10 @@ struct channel
                                    any interrupt would be spurious. */
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
 
+    uint16_t bm_base;           /* Bus-master base I/O port, 0 if none. */
+    struct prd *prdt;           /* PRD table, in a palloc page. */
+    struct block_dispatcher *dispatcher; /* 本通道的请求调度线程 */
+
     struct ata_disk devices[2];     /* The devices on this channel. */
   };
 
@@ -79,16 +135,28 @@ struct channel
 #define CHANNEL_CNT 2
 static struct channel channels[CHANNEL_CNT];
 
+/* True if disks that support DMA should use it. */
+static bool dma_enabled = true;
+
 static struct block_operations ide_operations;
 
+static uint16_t find_bus_master (void);
 static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
-
-static void select_sector (struct ata_disk *, block_sector_t);
-static void issue_pio_command (struct channel *, uint8_t command);
-static void input_sector (struct channel *, void *);
-static void output_sector (struct channel *, const void *);
+static void set_multiple_mode (struct ata_disk *, int max_multiple);
+
+static void select_sectors (struct ata_disk *, block_sector_t, size_t cnt);
+static void issue_command (struct channel *, uint8_t command);
+static void input_sectors (struct channel *, void *, size_t cnt);
+static void output_sectors (struct channel *, const void *, size_t cnt);
+static void pio_read (struct ata_disk *, block_sector_t, size_t cnt,
+                      void *buffer);
+static void pio_write (struct ata_disk *, block_sector_t, size_t cnt,
+                       const void *buffer);
+static bool use_dma (const struct ata_disk *, const void *buffer);
+static bool dma_transfer (struct ata_disk *, block_sector_t, size_t cnt,
+                          void *buffer, bool write);
 
 static void wait_until_idle (const struct ata_disk *);
 static bool wait_while_busy (const struct ata_disk *);
@@ -101,6 +169,7 @@ static void interrupt_handler (struct intr_frame *);
 void
 ide_init (void) 
 {
+  uint16_t bm_base = find_bus_master ();
   size_t chan_no;
 
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
@@ -124,8 +193,14 @@ ide_init (void)
           NOT_REACHED ();
         }
       lock_init (&c->lock);
+      lock_set_name (&c->lock, c->name);
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
+
+      /* Each channel has 8 bus-master ports of its own. */
+      c->bm_base = bm_base != 0 ? bm_base + chan_no * 8 : 0;
+      c->prdt = bm_base != 0 ? palloc_get_page (PAL_ASSERT) : NULL;
+      c->dispatcher = NULL;
  
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -136,6 +211,8 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->multiple = 0;
+          d->dma = false;
         }
 
       /* Register interrupt handler. */
@@ -154,6 +231,105 @@ ide_init (void)
           identify_ata_device (&c->devices[dev_no]);
     }
 }
+
+/* Sets whether disks that support bus-master DMA use it.  DMA is
+   enabled initially. */
+void
+ide_set_dma (bool enable)
+{
+  dma_enabled = enable;
+}
+
+/* Returns true if at least one disk supports bus-master DMA. */
+bool
+ide_has_dma (void)
+{
+  size_t chan_no;
+  int dev_no;
+
+  for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
+    for (dev_no = 0; dev_no < 2; dev_no++)
+      if (channels[chan_no].devices[dev_no].dma)
+        return true;
+  return false;
+}
+
+/* PCI bus-master IDE controller detection. */
+
+/* PCI configuration space access ports. */
+#define PCI_CONFIG_ADDRESS 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+
+/* PCI Command Register bits. */
+#define PCI_CMD_IO 0x0001               /* Respond to I/O space accesses. */
+#define PCI_CMD_BUS_MASTER 0x0004       /* Allow bus mastering. */
+
+/* Returns the 32-bit configuration register at byte offset REG
+   of function FUNC of device DEV on PCI bus 0. */
+static uint32_t
+pci_read_config (int dev, int func, int reg)
+{
+  outl (PCI_CONFIG_ADDRESS,
+        0x80000000 | (dev << 11) | (func << 8) | (reg & 0xfc));
+  return inl (PCI_CONFIG_DATA);
+}
+
+/* Sets the 32-bit configuration register at byte offset REG of
+   function FUNC of device DEV on PCI bus 0 to VALUE. */
+static void
+pci_write_config (int dev, int func, int reg, uint32_t value)
+{
+  outl (PCI_CONFIG_ADDRESS,
+        0x80000000 | (dev << 11) | (func << 8) | (reg & 0xfc));
+  outl (PCI_CONFIG_DATA, value);
+}
+
+/* Looks on PCI bus 0 for an IDE controller that supports
+   bus-master DMA and drives the two legacy channels, as opposed
+   to channels at ports of its own ("native mode").  Enables bus
+   mastering on it and returns its bus-master base I/O port, or 0
+   if there is no such controller. */
+static uint16_t
+find_bus_master (void)
+{
+  int dev, func;
+
+  for (dev = 0; dev < 32; dev++)
+    for (func = 0; func < 8; func++)
+      {
+        uint32_t id = pci_read_config (dev, func, 0x00);
+        uint32_t class, bar4, command;
+
+        if ((id & 0xffff) == 0xffff)
+          {
+            /* No device, or no such function. */
+            if (func == 0)
+              break;
+            continue;
+          }
+
+        /* Class 1 (mass storage), subclass 1 (IDE), with bit 7 of
+           the programming interface (bus master) set and bits 0
+           and 2 (native mode) clear. */
+        class = pci_read_config (dev, func, 0x08);
+        if ((class >> 16) != 0x0101 || (class & 0x8000) == 0
+            || (class & 0x0500) != 0)
+          continue;
+
+        /* BAR4 holds the bus-master ports, in I/O space. */
+        bar4 = pci_read_config (dev, func, 0x20);
+        if ((bar4 & 1) == 0 || (bar4 & 0xfffc) == 0)
+          continue;
+
+        command = pci_read_config (dev, func, 0x04) & 0xffff;
+        pci_write_config (dev, func, 0x04,
+                          command | PCI_CMD_IO | PCI_CMD_BUS_MASTER);
+        printf ("ide: bus-master DMA at I/O port 0x%04x\n",
+                (unsigned) (bar4 & 0xfffc));
+        return bar4 & 0xfffc;
+      }
+  return 0;
+}
 
 /* Disk detection and identification. */
 
@@ -272,14 +448,14 @@ identify_ata_device (struct ata_disk *d)
      indicating the device's response is ready, and read the data
      into our buffer. */
   select_device_wait (d);
-  issue_pio_command (c, CMD_IDENTIFY_DEVICE);
+  issue_command (c, CMD_IDENTIFY_DEVICE);
   sema_down (&c->completion_wait);
   if (!wait_while_busy (d))
     {
       d->is_ata = false;
       return;
     }
-  input_sector (c, id);
+  input_sectors (c, id, 1);
 
   /* Calculate capacity.
      Read model name and serial number. */
@@ -303,12 +479,45 @@ identify_ata_device (struct ata_disk *d)
       return;
     }
 
-  /* Register. */
+  /* Transfer as many sectors per interrupt as the disk allows
+     with READ/WRITE MULTIPLE.  Use DMA instead if both the disk
+     (bit 8 of word 49) and the controller support it. */
+  set_multiple_mode (d, *(uint16_t *) &id[47 * 2] & 0xff);
+  d->dma = c->bm_base != 0 && (*(uint16_t *) &id[49 * 2] & 0x100) != 0;
+
+  /* Register.  Requests to both disks on a channel are queued
+     and carried out by one dispatcher thread per channel. */
   block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
                           &ide_operations, d);
+  if (c->dispatcher == NULL)
+    c->dispatcher = block_dispatcher_create (c->name);
+  block_set_dispatcher (block, c->dispatcher);
   partition_scan (block);
 }
 
+/* Sends a SET MULTIPLE MODE command to disk D, so that READ and
+   WRITE MULTIPLE transfer MAX_MULTIPLE sectors per interrupt.
+   If MAX_MULTIPLE is 0 or the command fails, D is read and
+   written with READ and WRITE SECTOR, one sector per
+   interrupt. */
+static void
+set_multiple_mode (struct ata_disk *d, int max_multiple)
+{
+  struct channel *c = d->channel;
+
+  d->multiple = 0;
+  if (max_multiple == 0)
+    return;
+
+  select_device_wait (d);
+  outb (reg_nsect (c), max_multiple);
+  issue_command (c, CMD_SET_MULTIPLE_MODE);
+  sema_down (&c->completion_wait);
+  wait_while_busy (d);
+  if ((inb (reg_status (c)) & STA_ERR) == 0)
+    d->multiple = max_multiple;
+}
+
 /* Translates STRING, which consists of SIZE bytes in a funky
    format, into a null-terminated string in-place.  Drops
    trailing whitespace and null bytes.  Returns STRING.  */
@@ -337,63 +546,103 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
-/* Reads sector SEC_NO from disk D into BUFFER, which must have
-   room for BLOCK_SECTOR_SIZE bytes.
+/* Reads the CNT sectors starting at SEC_NO from disk D into
+   BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE bytes.
+   Issues one command per MAX_TRANSFER sectors, using DMA if D
+   supports it and PIO otherwise.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_read (void *d_, block_sector_t sec_no, void *buffer)
+ide_read_multi (void *d_, block_sector_t sec_no, size_t cnt, void *buffer_)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+  uint8_t *buffer = buffer_;
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
+  while (cnt > 0)
+    {
+      size_t n = cnt < MAX_TRANSFER ? cnt : MAX_TRANSFER;
+      if (!use_dma (d, buffer) || !dma_transfer (d, sec_no, n, buffer, false))
+        pio_read (d, sec_no, n, buffer);
+      buffer += n * BLOCK_SECTOR_SIZE;
+      sec_no += n;
+      cnt -= n;
+    }
   lock_release (&c->lock);
 }
 
-/* Write sector SEC_NO to disk D from BUFFER, which must contain
-   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
-   acknowledged receiving the data.
+/* Writes the CNT sectors starting at SEC_NO to disk D from
+   BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes, in
+   the same way that ide_read_multi() reads them.  Returns after
+   the disk has acknowledged receiving the data.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+ide_write_multi (void *d_, block_sector_t sec_no, size_t cnt,
+                 const void *buffer_)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+  const uint8_t *buffer = buffer_;
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
+  while (cnt > 0)
+    {
+      size_t n = cnt < MAX_TRANSFER ? cnt : MAX_TRANSFER;
+      if (!use_dma (d, buffer)
+          || !dma_transfer (d, sec_no, n, (void *) buffer, true))
+        pio_write (d, sec_no, n, buffer);
+      buffer += n * BLOCK_SECTOR_SIZE;
+      sec_no += n;
+      cnt -= n;
+    }
   lock_release (&c->lock);
 }
 
+/* Reads sector SEC_NO from disk D into BUFFER, which must have
+   room for BLOCK_SECTOR_SIZE bytes.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_read (void *d, block_sector_t sec_no, void *buffer)
+{
+  ide_read_multi (d, sec_no, 1, buffer);
+}
+
+/* Write sector SEC_NO to disk D from BUFFER, which must contain
+   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
+   acknowledged receiving the data.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_write (void *d, block_sector_t sec_no, const void *buffer)
+{
+  ide_write_multi (d, sec_no, 1, buffer);
+}
+
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_read_multi,
+    ide_write_multi
   };
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
+   writes SEC_NO and CNT, which must be between 1 and
+   MAX_TRANSFER, to the disk's sector selection registers.  (We
    use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sectors (struct ata_disk *d, block_sector_t sec_no, size_t cnt)
 {
   struct channel *c = d->channel;
 
-  ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt > 0 && cnt <= MAX_TRANSFER);
+  ASSERT (sec_no < (1UL << 28) && cnt <= (1UL << 28) - sec_no);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt == MAX_TRANSFER ? 0 : cnt);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -404,7 +653,7 @@ select_sector (struct ata_disk *d, block_sector_t sec_no)
 /* Writes COMMAND to channel C and prepares for receiving a
    completion interrupt. */
 static void
-issue_pio_command (struct channel *c, uint8_t command) 
+issue_command (struct channel *c, uint8_t command) 
 {
   /* Interrupts must be enabled or our semaphore will never be
      up'd by the completion handler. */
@@ -414,20 +663,154 @@ issue_pio_command (struct channel *c, uint8_t command)
   outb (reg_command (c), command);
 }
 
-/* Reads a sector from channel C's data register in PIO mode into
-   SECTOR, which must have room for BLOCK_SECTOR_SIZE bytes. */
+/* Reads the CNT sectors, at most MAX_TRANSFER, starting at SEC_NO
+   from disk D into BUFFER in PIO mode.  With READ MULTIPLE the
+   disk interrupts once per D->multiple sectors, otherwise once
+   per sector.  Must be called with D's channel lock held. */
+static void
+pio_read (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+          void *buffer_)
+{
+  struct channel *c = d->channel;
+  uint8_t *buffer = buffer_;
+  bool multiple = d->multiple > 1 && cnt > 1;
+  size_t per_block = multiple ? (size_t) d->multiple : 1;
+  size_t done, block_cnt;
+
+  select_sectors (d, sec_no, cnt);
+  issue_command (c, multiple ? CMD_READ_MULTIPLE : CMD_READ_SECTOR_RETRY);
+  for (done = 0; done < cnt; done += block_cnt)
+    {
+      block_cnt = cnt - done < per_block ? cnt - done : per_block;
+      sema_down (&c->completion_wait);
+      if (!wait_while_busy (d))
+        PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no + done);
+      input_sectors (c, buffer, block_cnt);
+      buffer += block_cnt * BLOCK_SECTOR_SIZE;
+    }
+}
+
+/* Writes the CNT sectors, at most MAX_TRANSFER, starting at
+   SEC_NO to disk D from BUFFER in PIO mode, as pio_read() reads
+   them.  Must be called with D's channel lock held. */
+static void
+pio_write (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+           const void *buffer_)
+{
+  struct channel *c = d->channel;
+  const uint8_t *buffer = buffer_;
+  bool multiple = d->multiple > 1 && cnt > 1;
+  size_t per_block = multiple ? (size_t) d->multiple : 1;
+  size_t done, block_cnt;
+
+  select_sectors (d, sec_no, cnt);
+  issue_command (c, multiple ? CMD_WRITE_MULTIPLE : CMD_WRITE_SECTOR_RETRY);
+  for (done = 0; done < cnt; done += block_cnt)
+    {
+      block_cnt = cnt - done < per_block ? cnt - done : per_block;
+      if (!wait_while_busy (d))
+        PANIC ("%s: disk write failed, sector=%"PRDSNu,
+               d->name, sec_no + done);
+      output_sectors (c, buffer, block_cnt);
+      buffer += block_cnt * BLOCK_SECTOR_SIZE;
+      sema_down (&c->completion_wait);
+    }
+}
+
+/* Returns true if disk D should transfer BUFFER with DMA, which
+   requires BUFFER to be word-aligned. */
+static bool
+use_dma (const struct ata_disk *d, const void *buffer)
+{
+  return d->dma && dma_enabled && ((uintptr_t) buffer & 1) == 0;
+}
+
+/* Fills in channel C's PRD table to describe the SIZE bytes of
+   BUFFER, which must be in kernel memory.  Kernel virtual memory
+   maps physical memory one to one, so BUFFER is physically
+   contiguous and only needs splitting at 64 kB boundaries. */
+static void
+build_prdt (struct channel *c, void *buffer, size_t size)
+{
+  uintptr_t addr = vtop (buffer);
+  struct prd *prd = c->prdt;
+
+  ASSERT (size > 0);
+  for (;;)
+    {
+      size_t chunk = PRD_BOUNDARY - addr % PRD_BOUNDARY;
+      if (chunk > size)
+        chunk = size;
+
+      ASSERT (prd < c->prdt + PGSIZE / sizeof *prd);
+      prd->addr = addr;
+      prd->size = chunk;
+      prd->flags = 0;
+      addr += chunk;
+      size -= chunk;
+      if (size == 0)
+        break;
+      prd++;
+    }
+  prd->flags = PRD_EOT;
+}
+
+/* Transfers the CNT sectors, at most MAX_TRANSFER, starting at
+   SEC_NO between disk D and BUFFER with bus-master DMA: reads
+   them into BUFFER if WRITE is false, writes them from BUFFER if
+   it is true.  The calling thread sleeps on completion_wait
+   while the controller moves the data.  Must be called with D's
+   channel lock held.
+   Returns true if successful.  On failure, turns off DMA for D
+   and returns false, so that the caller can fall back to PIO. */
+static bool
+dma_transfer (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+              void *buffer, bool write)
+{
+  struct channel *c = d->channel;
+  uint8_t direction = write ? 0 : BM_CMD_READ;
+  uint8_t bm_status;
+
+  build_prdt (c, buffer, cnt * BLOCK_SECTOR_SIZE);
+  outb (reg_bm_command (c), direction);
+  outl (reg_bm_prdt (c), vtop (c->prdt));
+  outb (reg_bm_status (c), inb (reg_bm_status (c)) | BM_STA_ERR | BM_STA_IRQ);
+
+  select_sectors (d, sec_no, cnt);
+  issue_command (c, write ? CMD_WRITE_DMA : CMD_READ_DMA);
+  outb (reg_bm_command (c), direction | BM_CMD_START);
+  sema_down (&c->completion_wait);
+  outb (reg_bm_command (c), direction);
+
+  bm_status = inb (reg_bm_status (c));
+  outb (reg_bm_status (c), bm_status | BM_STA_ERR | BM_STA_IRQ);
+  if ((bm_status & (BM_STA_ERR | BM_STA_ACTIVE)) != 0
+      || (inb (reg_alt_status (c)) & STA_ERR) != 0)
+    {
+      printf ("%s: DMA transfer failed, sector=%"PRDSNu"; using PIO\n",
+              d->name, sec_no);
+      d->dma = false;
+      return false;
+    }
+  return true;
+}
+
+/* Reads CNT sectors from channel C's data register in PIO mode
+   into SECTORS, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes. */
 static void
-input_sector (struct channel *c, void *sector) 
+input_sectors (struct channel *c, void *sectors, size_t cnt) 
 {
-  insw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
+  insw (reg_data (c), sectors, cnt * BLOCK_SECTOR_SIZE / 2);
 }
 
-/* Writes SECTOR to channel C's data register in PIO mode.
-   SECTOR must contain BLOCK_SECTOR_SIZE bytes. */
+/* Writes CNT sectors from SECTORS to channel C's data register in
+   PIO mode.  SECTORS must contain CNT * BLOCK_SECTOR_SIZE
+   bytes. */
 static void
-output_sector (struct channel *c, const void *sector) 
+output_sectors (struct channel *c, const void *sectors, size_t cnt) 
 {
-  outsw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
+  outsw (reg_data (c), sectors, cnt * BLOCK_SECTOR_SIZE / 2);
 }
 
 /* Low-level ATA primitives. */
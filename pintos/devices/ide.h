@@ -1,6 +1,10 @@
 #ifndef DEVICES_IDE_H
 #define DEVICES_IDE_H
 
+#include <stdbool.h>
+
 void ide_init (void);
+void ide_set_dma (bool enable);
+bool ide_has_dma (void);
 
 #endif /* devices/ide.h */
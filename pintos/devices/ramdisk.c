@@ -0,0 +1,132 @@
+#include "devices/ramdisk.h"
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* A RAM disk: a block device whose sectors are kept in pages
+   from the kernel pool.  Its contents are lost at shutdown, so
+   it is only useful for file systems and swap that are created
+   afresh at each boot, e.g. to measure file system overhead
+   without paying for emulated disk access. */
+struct ramdisk
+  {
+    uint8_t **pages;            /* Pages holding the sectors. */
+    size_t page_cnt;            /* Number of pages. */
+  };
+
+/* Sectors per page. */
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+static struct block_operations ramdisk_operations;
+
+/* Registers a RAM disk named NAME of SIZE_KB kB, rounded up to
+   a whole number of pages, with all of its sectors zeroed.
+   Returns the new device.  Panics if the kernel pool does not
+   have enough free pages. */
+struct block *
+ramdisk_register (const char *name, size_t size_kb)
+{
+  struct ramdisk *rd;
+  size_t i;
+
+  ASSERT (size_kb > 0);
+
+  rd = malloc (sizeof *rd);
+  if (rd == NULL)
+    PANIC ("Failed to allocate memory for RAM disk descriptor");
+  rd->page_cnt = DIV_ROUND_UP (size_kb * 1024, PGSIZE);
+  rd->pages = malloc (rd->page_cnt * sizeof *rd->pages);
+  if (rd->pages == NULL)
+    PANIC ("Failed to allocate memory for RAM disk page table");
+  for (i = 0; i < rd->page_cnt; i++)
+    {
+      rd->pages[i] = palloc_get_page (PAL_ZERO);
+      if (rd->pages[i] == NULL)
+        PANIC ("%s: out of kernel pages after %zu of %zu pages",
+               name, i, rd->page_cnt);
+    }
+
+  return block_register (name, BLOCK_RAW, "RAM disk",
+                         rd->page_cnt * SECTORS_PER_PAGE,
+                         &ramdisk_operations, rd);
+}
+
+/* 返回RAM盘RD中扇区SECTOR的数据地址。 */
+static uint8_t *
+sector_data (struct ramdisk *rd, block_sector_t sector)
+{
+  return (rd->pages[sector / SECTORS_PER_PAGE]
+          + sector % SECTORS_PER_PAGE * BLOCK_SECTOR_SIZE);
+}
+
+/* Reads CNT sectors starting at SECTOR from RAM disk RD into
+   BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes. */
+static void
+ramdisk_read_multi (void *rd, block_sector_t sector, size_t cnt,
+                    void *buffer_)
+{
+  uint8_t *buffer = buffer_;
+
+  while (cnt > 0)
+    {
+      /* 一次复制到页末为止。 */
+      size_t chunk_cnt = SECTORS_PER_PAGE - sector % SECTORS_PER_PAGE;
+      if (chunk_cnt > cnt)
+        chunk_cnt = cnt;
+      memcpy (buffer, sector_data (rd, sector),
+              chunk_cnt * BLOCK_SECTOR_SIZE);
+      sector += chunk_cnt;
+      cnt -= chunk_cnt;
+      buffer += chunk_cnt * BLOCK_SECTOR_SIZE;
+    }
+}
+
+/* Writes CNT sectors starting at SECTOR to RAM disk RD from
+   BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes. */
+static void
+ramdisk_write_multi (void *rd, block_sector_t sector, size_t cnt,
+                     const void *buffer_)
+{
+  const uint8_t *buffer = buffer_;
+
+  while (cnt > 0)
+    {
+      size_t chunk_cnt = SECTORS_PER_PAGE - sector % SECTORS_PER_PAGE;
+      if (chunk_cnt > cnt)
+        chunk_cnt = cnt;
+      memcpy (sector_data (rd, sector), buffer,
+              chunk_cnt * BLOCK_SECTOR_SIZE);
+      sector += chunk_cnt;
+      cnt -= chunk_cnt;
+      buffer += chunk_cnt * BLOCK_SECTOR_SIZE;
+    }
+}
+
+/* Reads sector SECTOR from RAM disk RD into BUFFER, which must
+   have room for BLOCK_SECTOR_SIZE bytes. */
+static void
+ramdisk_read (void *rd, block_sector_t sector, void *buffer)
+{
+  memcpy (buffer, sector_data (rd, sector), BLOCK_SECTOR_SIZE);
+}
+
+/* Writes sector SECTOR to RAM disk RD from BUFFER, which must
+   contain BLOCK_SECTOR_SIZE bytes. */
+static void
+ramdisk_write (void *rd, block_sector_t sector, const void *buffer)
+{
+  memcpy (sector_data (rd, sector), buffer, BLOCK_SECTOR_SIZE);
+}
+
+static struct block_operations ramdisk_operations =
+  {
+    ramdisk_read,
+    ramdisk_write,
+    ramdisk_read_multi,
+    ramdisk_write_multi
+  };
@@ -0,0 +1,155 @@
+#include "devices/stripe.h"
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* A striped (RAID-0) block device.
+
+   The device's sectors are divided into chunks of STRIPE_SECTORS
+   sectors, and consecutive chunks are placed on the member
+   devices in turn.  A long transfer thus becomes one request per
+   member, which the members' dispatchers carry out at the same
+   time when the members are on different IDE channels. */
+struct stripe
+  {
+    struct block *members[STRIPE_MAX];  /* Member devices. */
+    size_t member_cnt;                  /* Number of members. */
+  };
+
+/* Sectors per chunk. */
+#define STRIPE_SECTORS 8
+
+/* Most member requests outstanding at once per transfer. */
+#define STRIPE_BATCH 16
+
+static struct block_operations stripe_operations;
+
+/* Registers a block device named NAME that stripes its sectors
+   across the MEMBER_CNT devices in MEMBERS, which should not be
+   used for anything else.  Its size is MEMBER_CNT times the size
+   of the smallest member, rounded down to a whole number of
+   chunks.  Returns the new device.  Panics on failure. */
+struct block *
+stripe_register (const char *name, struct block *members[],
+                 size_t member_cnt)
+{
+  struct stripe *s;
+  block_sector_t size;
+  char extra_info[128];
+  size_t i;
+
+  ASSERT (member_cnt > 0 && member_cnt <= STRIPE_MAX);
+
+  s = malloc (sizeof *s);
+  if (s == NULL)
+    PANIC ("Failed to allocate memory for striped device descriptor");
+  s->member_cnt = member_cnt;
+  size = block_size (members[0]);
+  snprintf (extra_info, sizeof extra_info, "striped across");
+  for (i = 0; i < member_cnt; i++)
+    {
+      s->members[i] = members[i];
+      if (block_size (members[i]) < size)
+        size = block_size (members[i]);
+      snprintf (extra_info + strlen (extra_info),
+                sizeof extra_info - strlen (extra_info),
+                " %s", block_name (members[i]));
+    }
+  size = size / STRIPE_SECTORS * STRIPE_SECTORS * member_cnt;
+  if (size == 0)
+    PANIC ("%s: member devices too small to stripe", name);
+
+  return block_register (name, BLOCK_RAW, extra_info, size,
+                         &stripe_operations, s);
+}
+
+/* 成员请求的完成回调：唤醒等待的线程。 */
+static void
+wake_up (struct block_request *r UNUSED, void *done)
+{
+  sema_up (done);
+}
+
+/* 传输条带设备S上从SECTOR开始的CNT个扇区。按块拆分成各成员的
+   请求，一次最多提交STRIPE_BATCH个，等它们全部完成再继续。
+   同一成员上相邻的块由成员的调度线程合并传输。 */
+static void
+stripe_transfer (struct stripe *s, bool write, block_sector_t sector,
+                 size_t cnt, void *buffer_)
+{
+  uint8_t *buffer = buffer_;
+  struct block_request requests[STRIPE_BATCH];
+  struct semaphore done;
+
+  sema_init (&done, 0);
+  while (cnt > 0)
+    {
+      size_t n;
+
+      for (n = 0; n < STRIPE_BATCH && cnt > 0; n++)
+        {
+          block_sector_t chunk = sector / STRIPE_SECTORS;
+          size_t ofs = sector % STRIPE_SECTORS;
+          size_t chunk_cnt = STRIPE_SECTORS - ofs;
+          if (chunk_cnt > cnt)
+            chunk_cnt = cnt;
+
+          block_request_init (&requests[n], write,
+                              chunk / s->member_cnt * STRIPE_SECTORS + ofs,
+                              chunk_cnt, buffer, wake_up, &done);
+          block_submit (s->members[chunk % s->member_cnt], &requests[n]);
+
+          sector += chunk_cnt;
+          cnt -= chunk_cnt;
+          buffer += chunk_cnt * BLOCK_SECTOR_SIZE;
+        }
+      while (n-- > 0)
+        sema_down (&done);
+    }
+}
+
+/* Reads sector SECTOR from striped device S into BUFFER, which
+   must have room for BLOCK_SECTOR_SIZE bytes. */
+static void
+stripe_read (void *s, block_sector_t sector, void *buffer)
+{
+  stripe_transfer (s, false, sector, 1, buffer);
+}
+
+/* Writes sector SECTOR to striped device S from BUFFER, which
+   must contain BLOCK_SECTOR_SIZE bytes.  Returns after the
+   member device has acknowledged receiving the data. */
+static void
+stripe_write (void *s, block_sector_t sector, const void *buffer)
+{
+  stripe_transfer (s, true, sector, 1, (void *) buffer);
+}
+
+/* Reads CNT sectors starting at SECTOR from striped device S
+   into BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes. */
+static void
+stripe_read_multi (void *s, block_sector_t sector, size_t cnt,
+                   void *buffer)
+{
+  stripe_transfer (s, false, sector, cnt, buffer);
+}
+
+/* Writes CNT sectors starting at SECTOR to striped device S from
+   BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes. */
+static void
+stripe_write_multi (void *s, block_sector_t sector, size_t cnt,
+                    const void *buffer)
+{
+  stripe_transfer (s, true, sector, cnt, (void *) buffer);
+}
+
+static struct block_operations stripe_operations =
+  {
+    stripe_read,
+    stripe_write,
+    stripe_read_multi,
+    stripe_write_multi
+  };
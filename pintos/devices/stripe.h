@@ -0,0 +1,14 @@
+#ifndef DEVICES_STRIPE_H
+#define DEVICES_STRIPE_H
+
+#include <stddef.h>
+
+struct block;
+
+/* Most block devices that one striped device may span. */
+#define STRIPE_MAX 4
+
+struct block *stripe_register (const char *name, struct block *members[],
+                               size_t member_cnt);
+
+#endif /* devices/stripe.h */
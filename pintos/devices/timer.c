@@ -17,24 +17,42 @@
 #error TIMER_FREQ <= 1000 recommended
 #endif
 
-/* Number of timer ticks since OS booted. */
+/* Number of timer ticks since OS booted.
+   Written only by the timer interrupt, read through ticks_seqlock. */
 static int64_t ticks;
+static struct seqlock ticks_seqlock;
 
 /* Number of loops per timer tick.
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
-/* 所有闹钟列表。 */
-static struct list alarm_list;
+/* 所有闹钟组成的二叉最小堆，按唤醒时刻排序，堆顶是最早到期的闹钟。
+   闹钟在睡眠线程的栈上，堆直接用闹钟中的指针连成完全二叉树，
+   不需要另外分配内存。插入和取出堆顶都是O(log n)。 */
+static struct alarm *alarm_heap;
+static size_t alarm_cnt;                /* 堆中的闹钟数 */
+static unsigned alarm_seq;              /* 下一个闹钟的序号 */
+
+/* 时钟中断中检查过的闹钟数量（统计用）。 */
+static int64_t alarms_examined;
 
 /* 闹钟结构体。 */
 struct alarm
 {
-  struct list_elem elem;                /* list element. */
-  int ticks;                            /* ticks数量。 */
+  struct alarm *parent;                 /* 堆中的父节点，堆顶为NULL。 */
+  struct alarm *left, *right;           /* 堆中的子节点。 */
+  int64_t wakeup;                       /* 唤醒时刻（绝对ticks）。 */
+  unsigned seq;                         /* 设置顺序，唤醒时刻相同时先设置的先唤醒。 */
   struct thread *thread;                /* 启动该闹钟的进程。 */
 };
 
+static void alarm_init (void);
+static void alarm_push (struct alarm *);
+static struct alarm *alarm_pop (void);
+static void alarm_on (struct thread *, int64_t ticks);
+static void alarm_check_all (void);
+static void alarm_wakeup (struct thread *);
+
 static intr_handler_func timer_interrupt;
 static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
@@ -46,6 +64,7 @@ static void real_time_delay (int64_t num, int32_t denom);
 void
 timer_init (void) 
 {
+  seqlock_init (&ticks_seqlock);
   pit_configure_channel (0, 2, TIMER_FREQ);
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
 
@@ -83,9 +102,16 @@ timer_calibrate (void)
 int64_t
 timer_ticks (void) 
 {
-  enum intr_level old_level = intr_disable ();
-  int64_t t = ticks;
-  intr_set_level (old_level);
+  unsigned seq;
+  int64_t t;
+
+  /* 读取过程中发生时钟中断则重新读取，不需要关中断。 */
+  do
+    {
+      seq = seqlock_read_begin (&ticks_seqlock);
+      t = ticks;
+    }
+  while (seqlock_read_retry (&ticks_seqlock, seq));
   return t;
 }
 
@@ -97,54 +123,205 @@ timer_elapsed (int64_t then)
   return timer_ticks () - then;
 }
 
+/* Returns the tick at which the earliest pending timer_sleep()
+   alarm is due, or INT64_MAX if no thread is sleeping.  The idle
+   thread can use this to tell whether any upcoming tick has work
+   to do. */
+int64_t
+timer_next_wakeup (void)
+{
+  enum intr_level old_level = intr_disable ();
+  int64_t wakeup = INT64_MAX;
+
+  if (alarm_heap != NULL)
+    wakeup = alarm_heap->wakeup;
+  intr_set_level (old_level);
+  return wakeup;
+}
+
+/* Returns the number of alarms the timer interrupt handler has
+   examined since boot. */
+int64_t
+timer_alarms_examined (void)
+{
+  enum intr_level old_level = intr_disable ();
+  int64_t examined = alarms_examined;
+  intr_set_level (old_level);
+  return examined;
+}
+
+/* 闹钟A是否应在闹钟B之前唤醒。 */
+static bool
+alarm_before (const struct alarm *a, const struct alarm *b)
+{
+  if (a->wakeup != b->wakeup)
+    return a->wakeup < b->wakeup;
+  return (int) (a->seq - b->seq) < 0;
+}
+
 /* 初始化闹铃。 */
-void
-alarm_init ()
+static void
+alarm_init (void)
 {
-  list_init (&alarm_list);
+  alarm_heap = NULL;
+  alarm_cnt = 0;
 }
 
-/* 设置闹铃并开启睡眠 */
-void
-alarm_on(struct thread *t, int ticks)
+/* 返回指向A的指针所在的位置：父节点的left或right，或alarm_heap。 */
+static struct alarm **
+alarm_link (struct alarm *a)
+{
+  if (a->parent == NULL)
+    return &alarm_heap;
+  return a->parent->left == a ? &a->parent->left : &a->parent->right;
+}
+
+/* 返回堆中按层序第N个位置 (从1开始) 上的闹钟。从堆顶出发，
+   N的二进制表示去掉最高位后，从高到低每一位指出向左 (0) 还是
+   向右 (1) 走。 */
+static struct alarm *
+alarm_at (size_t n)
+{
+  struct alarm *a = alarm_heap;
+  int bit;
+
+  ASSERT (n >= 1);
+  for (bit = 0; (n >> bit) > 1; bit++)
+    continue;
+  while (--bit >= 0)
+    a = (n >> bit) & 1 ? a->right : a->left;
+  return a;
+}
+
+/* 交换闹钟C和它的父节点在堆中的位置。 */
+static void
+alarm_swap_up (struct alarm *c)
+{
+  struct alarm *p = c->parent;
+  struct alarm *cl = c->left, *cr = c->right;
+
+  *alarm_link (p) = c;
+  c->parent = p->parent;
+  if (p->left == c)
+    {
+      c->left = p;
+      c->right = p->right;
+      if (c->right != NULL)
+        c->right->parent = c;
+    }
+  else
+    {
+      c->right = p;
+      c->left = p->left;
+      if (c->left != NULL)
+        c->left->parent = c;
+    }
+  p->parent = c;
+  p->left = cl;
+  p->right = cr;
+  if (cl != NULL)
+    cl->parent = p;
+  if (cr != NULL)
+    cr->parent = p;
+}
+
+/* 把闹钟A放入堆中。必须在关中断的情况下调用。 */
+static void
+alarm_push (struct alarm *a)
+{
+  size_t n = ++alarm_cnt;
+
+  a->seq = alarm_seq++;
+  a->left = a->right = NULL;
+  if (n == 1)
+    {
+      a->parent = NULL;
+      alarm_heap = a;
+      return;
+    }
+
+  /* 放到最后一个位置，再向上调整 */
+  a->parent = alarm_at (n / 2);
+  if (n % 2 == 0)
+    a->parent->left = a;
+  else
+    a->parent->right = a;
+  while (a->parent != NULL && alarm_before (a, a->parent))
+    alarm_swap_up (a);
+}
+
+/* 取出并返回堆顶的闹钟，堆不能为空。必须在关中断的情况下调用。 */
+static struct alarm *
+alarm_pop (void)
+{
+  struct alarm *top = alarm_heap;
+  struct alarm *last;
+
+  ASSERT (alarm_cnt > 0);
+  if (alarm_cnt == 1)
+    {
+      alarm_heap = NULL;
+      alarm_cnt = 0;
+      return top;
+    }
+
+  /* 摘下最后一个位置的闹钟，放到堆顶，再向下调整 */
+  last = alarm_at (alarm_cnt--);
+  *alarm_link (last) = NULL;
+  last->parent = NULL;
+  last->left = top->left;
+  last->right = top->right;
+  if (last->left != NULL)
+    last->left->parent = last;
+  if (last->right != NULL)
+    last->right->parent = last;
+  alarm_heap = last;
+  for (;;)
+    {
+      struct alarm *min = last;
+      if (last->left != NULL && alarm_before (last->left, min))
+        min = last->left;
+      if (last->right != NULL && alarm_before (last->right, min))
+        min = last->right;
+      if (min == last)
+        break;
+      alarm_swap_up (min);
+    }
+  return top;
+}
+
+/* 设置闹铃并开启睡眠。唤醒时刻相同的闹钟按设置的先后顺序唤醒。 */
+static void
+alarm_on (struct thread *t, int64_t ticks)
 {
   enum intr_level old_level;
   struct alarm alarm;
 
-  alarm.ticks = ticks;
   alarm.thread = t;
-  list_push_back (&alarm_list, &alarm.elem);
 
-  /* thread_block()方法需要关闭中断 */
+  /* 插入堆和thread_block()都需要关闭中断 */
   old_level = intr_disable ();
+  alarm.wakeup = timer_ticks () + ticks;
+  alarm_push (&alarm);
   thread_block();
   intr_set_level (old_level);
 }
 
-/* 检查进程睡眠闹钟时间是否到达 */
-void
-alarm_check_all ()
+/* 唤醒所有到期的闹钟。只需检查堆顶。 */
+static void
+alarm_check_all (void)
 {
-  struct list_elem *e;
-
-  for (e = list_begin (&alarm_list); e != list_end (&alarm_list);
-       e = list_next (e))
+  while (alarm_heap != NULL)
     {
-      struct alarm *a = list_entry (e, struct alarm, elem);
-      if (a->ticks > 0)
-        {
-          a->ticks--;
-          if (a->ticks == 0)
-            {
-              list_remove (e);
-              alarm_wakeup (a->thread);
-            }
-        }
+      alarms_examined++;
+      if (alarm_heap->wakeup > ticks)
+        break;
+      alarm_wakeup (alarm_pop ()->thread);
     }
 }
 
 /* 闹钟时间到，唤醒睡眠进程。 */
-void
+static void
 alarm_wakeup (struct thread *t)
 {
   /* 解除阻塞，放到就绪队列。 */
@@ -244,7 +421,9 @@ timer_interrupt (struct intr_frame *args UNUSED)
   enum intr_level oldlevel = intr_disable ();
 
   /* ticks增加 */
+  seqlock_write_begin (&ticks_seqlock);
   ticks++;
+  seqlock_write_end (&ticks_seqlock);
 
   if (thread_mlfqs)
     {
@@ -265,8 +444,8 @@ timer_interrupt (struct intr_frame *args UNUSED)
           /* 更新load_avg. */
           load_avg_update();
 
-          /* 更新所有进程的rencent_cpu. */
-          thread_foreach (thread_recent_cpu_update, 0);
+          /* 更新运行和就绪进程的rencent_cpu，阻塞进程唤醒时再补算。 */
+          thread_recent_cpu_update ();
         }
 
       if (ticks % 4 == 0)
@@ -276,11 +455,11 @@ timer_interrupt (struct intr_frame *args UNUSED)
           the following formula every fourth tick:
           priority = PRI_MAX - (recent_cpu / 4) - (nice * 2).
           */
-          thread_foreach(thread_priority_update, 0);
+          thread_priority_update_active ();
         }
     }
 
-  /* 遍历alarm_list链表中所有闹钟，进行闹铃检测。 */
+  /* 唤醒所有到期的闹钟。 */
   alarm_check_all();
 
   intr_set_level (oldlevel);
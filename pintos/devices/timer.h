@@ -18,6 +18,7 @@ void timer_sleep (int64_t ticks);
 void timer_msleep (int64_t milliseconds);
 void timer_usleep (int64_t microseconds);
 void timer_nsleep (int64_t nanoseconds);
+int64_t timer_next_wakeup (void);
 
 /* Busy waits. */
 void timer_mdelay (int64_t milliseconds);
@@ -25,5 +26,6 @@ void timer_udelay (int64_t microseconds);
 void timer_ndelay (int64_t nanoseconds);
 
 void timer_print_stats (void);
+int64_t timer_alarms_examined (void);
 
 #endif /* devices/timer.h */
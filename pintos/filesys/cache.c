@@ -0,0 +1,574 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/filesys.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+/* Buffer cache for the file system device.
+
+   All file system I/O goes through a fixed table of CACHE_SIZE
+   sector buffers.  Writes only mark a buffer dirty; dirty
+   buffers reach the disk when they are evicted, when the flush
+   thread runs every FLUSH_INTERVAL, and in filesys_done().
+   Buffers are replaced with the clock algorithm.
+
+   cache_lock protects the table: each entry's sector, its
+   accessed and prefetched bits, and its pin count.  An entry's
+   own lock protects its data and dirty bit.  A thread pins an
+   entry, under cache_lock, before taking the entry's lock and
+   unpins it after releasing it, so an entry with a zero pin
+   count is unlocked and may be evicted.  Only the rare write-back of a dirty
+   victim happens with cache_lock held.  The uncommitted bit is
+   set holding both locks and cleared holding cache_lock, so
+   either lock is enough to see that it is set.
+
+   Sectors written with cache_write_uncommitted() hold metadata
+   changes of a journal transaction that has not committed yet.
+   They are neither evicted nor written back until the journal
+   calls cache_commit() for them, so the disk never sees a change
+   before the journal does.  The journal keeps transactions much
+   smaller than the cache.
+
+   cache_read_ahead() queues a sector that a sequential reader is
+   expected to want soon.  A read-ahead thread loads queued
+   sectors into the cache in the background, so that the reader's
+   own cache_read() hits.  The queue is only a hint: requests are
+   dropped when it is full.
+
+   Consecutive sectors move between the cache and the disk
+   together when possible: cache_prefetch() and the read-ahead
+   thread read each run of consecutive sectors that are missing
+   from the cache with one block_read_multi(), and cache_flush()
+   writes back each run of consecutive dirty sectors with one
+   block_write_multi(). */
+
+/* How often the flush thread writes dirty buffers back. */
+#define FLUSH_INTERVAL (5 * TIMER_FREQ)
+
+/* Maximum number of queued read-ahead requests. */
+#define READ_AHEAD_QUEUE 32
+
+/* Most sectors read or written back with one request. */
+#define RUN_MAX 16
+
+/* A cached sector. */
+struct cache_entry
+  {
+    block_sector_t sector;              /* 缓存的扇区 */
+    bool valid;                         /* sector和data是否有效 */
+    bool accessed;                      /* clock算法的访问位 */
+    bool prefetched;                    /* 由预读载入且尚未被读过 */
+    int pin_cnt;                        /* 正在使用的线程数 */
+    struct lock lock;                   /* 保护data和dirty */
+    bool dirty;                         /* data是否比磁盘新 */
+    bool uncommitted;                   /* 含未提交的日志修改，见上 */
+    uint8_t data[BLOCK_SECTOR_SIZE];    /* 扇区内容 */
+  };
+
+static struct cache_entry cache[CACHE_SIZE];
+static struct lock cache_lock;
+static struct condition cache_unpinned; /* 有条目的pin_cnt变为0 */
+static size_t clock_hand;
+
+/* Read-ahead queue. */
+static block_sector_t ra_queue[READ_AHEAD_QUEUE]; /* 环形队列 */
+static size_t ra_head, ra_cnt;          /* 队首位置及请求数 */
+static struct lock ra_lock;             /* 保护队列 */
+static struct condition ra_nonempty;    /* 队列变为非空 */
+
+/* Buffers for multi-sector transfers. */
+static uint8_t *read_buffer;            /* load_run()读入的扇区 */
+static struct lock read_lock;           /* 保护read_buffer */
+static uint8_t *flush_buffer;           /* cache_flush()写回的扇区 */
+static struct lock flush_lock;          /* 保护flush_buffer，同时只有一个线程写回 */
+
+/* Statistics. */
+static unsigned long long hit_cnt;      /* 在缓存中找到的次数 */
+static unsigned long long miss_cnt;     /* 没有找到的次数 */
+static unsigned long long evict_cnt;    /* 替换有效条目的次数 */
+static unsigned long long writeback_cnt; /* 写回磁盘的次数 */
+static unsigned long long ra_load_cnt; /* 预读载入的扇区数 */
+static unsigned long long ra_hit_cnt;   /* 预读的扇区被读到的次数 */
+
+static thread_func flush_thread;
+static thread_func read_ahead_thread;
+static struct cache_entry *cache_lookup (block_sector_t);
+static struct cache_entry *cache_load (block_sector_t, bool need_read);
+static struct cache_entry *cache_get (block_sector_t, bool need_read);
+static void load_run (block_sector_t, size_t cnt, bool prefetch);
+static void write_run (struct cache_entry **, size_t cnt);
+static void cache_put (struct cache_entry *);
+static void cache_unpin (struct cache_entry *);
+
+/* Initializes the buffer cache and starts its flush thread. */
+void
+cache_init (void)
+{
+  size_t i;
+
+  lock_init (&cache_lock);
+  lock_set_name (&cache_lock, "buffer cache");
+  cond_init (&cache_unpinned);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+      e->valid = false;
+      e->accessed = false;
+      e->pin_cnt = 0;
+      lock_init (&e->lock);
+      e->prefetched = false;
+      e->dirty = false;
+      e->uncommitted = false;
+    }
+  clock_hand = 0;
+
+  ra_head = ra_cnt = 0;
+  lock_init (&ra_lock);
+  cond_init (&ra_nonempty);
+
+  read_buffer = malloc (RUN_MAX * BLOCK_SECTOR_SIZE);
+  flush_buffer = malloc (RUN_MAX * BLOCK_SECTOR_SIZE);
+  if (read_buffer == NULL || flush_buffer == NULL)
+    PANIC ("buffer cache: out of memory");
+  lock_init (&read_lock);
+  lock_init (&flush_lock);
+
+  thread_create ("cache_flush", PRI_DEFAULT, flush_thread, NULL);
+  thread_create ("cache_readahead", PRI_DEFAULT, read_ahead_thread, NULL);
+}
+
+/* Reads SIZE bytes starting at byte OFS of SECTOR of the file
+   system device into BUFFER. */
+void
+cache_read (block_sector_t sector, void *buffer, int ofs, int size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, true);
+  memcpy (buffer, e->data + ofs, size);
+  cache_put (e);
+}
+
+/* Writes SIZE bytes from BUFFER to SECTOR of the file system
+   device, starting at byte OFS.  The sector is read from disk
+   first unless the whole sector is overwritten. */
+void
+cache_write (block_sector_t sector, const void *buffer, int ofs, int size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, size < BLOCK_SECTOR_SIZE);
+  memcpy (e->data + ofs, buffer, size);
+  e->dirty = true;
+  cache_put (e);
+}
+
+/* Like cache_write(), but the change is part of the running
+   journal transaction, so the sector is not written back to disk
+   until cache_commit() is called for it. */
+void
+cache_write_uncommitted (block_sector_t sector, const void *buffer,
+                         int ofs, int size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, size < BLOCK_SECTOR_SIZE);
+  memcpy (e->data + ofs, buffer, size);
+  e->dirty = true;
+  lock_acquire (&cache_lock);
+  e->uncommitted = true;
+  lock_release (&cache_lock);
+  cache_put (e);
+}
+
+/* Allows SECTOR, written with cache_write_uncommitted(), to be
+   written back to disk, because its journal transaction has
+   committed. */
+void
+cache_commit (block_sector_t sector)
+{
+  struct cache_entry *e;
+
+  lock_acquire (&cache_lock);
+  e = cache_lookup (sector);
+  ASSERT (e != NULL);
+  e->uncommitted = false;
+  cond_broadcast (&cache_unpinned, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+/* Asks the read-ahead thread to load SECTOR of the file system
+   device into the cache.  Does nothing if the request is already
+   queued or the queue is full. */
+void
+cache_read_ahead (block_sector_t sector)
+{
+  size_t i;
+
+  lock_acquire (&ra_lock);
+  for (i = 0; i < ra_cnt; i++)
+    if (ra_queue[(ra_head + i) % READ_AHEAD_QUEUE] == sector)
+      break;
+  if (i == ra_cnt && ra_cnt < READ_AHEAD_QUEUE)
+    {
+      ra_queue[(ra_head + ra_cnt++) % READ_AHEAD_QUEUE] = sector;
+      cond_signal (&ra_nonempty, &ra_lock);
+    }
+  lock_release (&ra_lock);
+}
+
+/* Loads the CNT sectors starting at SECTOR into the cache,
+   reading each run of them that is not cached yet with a single
+   request. */
+void
+cache_prefetch (block_sector_t sector, size_t cnt)
+{
+  while (cnt > 0)
+    {
+      size_t n = cnt < RUN_MAX ? cnt : RUN_MAX;
+      load_run (sector, n, false);
+      sector += n;
+      cnt -= n;
+    }
+}
+
+/* Writes every dirty buffer back to disk, except those holding
+   uncommitted journal changes.  Does not return until all of
+   them are on disk, even if another thread was already
+   flushing. */
+void
+cache_flush (void)
+{
+  struct cache_entry *order[CACHE_SIZE];
+  struct cache_entry *run[RUN_MAX];
+  size_t order_cnt = 0, run_cnt = 0;
+  size_t i, j;
+
+  lock_acquire (&flush_lock);
+
+  /* 按扇区号排序，使连续的脏扇区可以一次写回。 */
+  lock_acquire (&cache_lock);
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (cache[i].valid)
+      {
+        for (j = order_cnt++; j > 0 && order[j - 1]->sector > cache[i].sector;
+             j--)
+          order[j] = order[j - 1];
+        order[j] = &cache[i];
+      }
+  lock_release (&cache_lock);
+
+  for (i = 0; i < order_cnt; i++)
+    {
+      struct cache_entry *e = order[i];
+      bool dirty;
+
+      lock_acquire (&cache_lock);
+      if (!e->valid)
+        {
+          lock_release (&cache_lock);
+          continue;
+        }
+      e->pin_cnt++;
+      lock_release (&cache_lock);
+
+      /* 复制到flush_buffer后就可以清除脏位：条目在写回之前一直
+         被固定，不会被替换。 */
+      lock_acquire (&e->lock);
+      dirty = e->dirty && !e->uncommitted;
+      if (dirty)
+        {
+          if (run_cnt == RUN_MAX
+              || (run_cnt > 0 && e->sector != run[run_cnt - 1]->sector + 1))
+            {
+              write_run (run, run_cnt);
+              run_cnt = 0;
+            }
+          memcpy (flush_buffer + run_cnt * BLOCK_SECTOR_SIZE, e->data,
+                  BLOCK_SECTOR_SIZE);
+          e->dirty = false;
+          run[run_cnt++] = e;
+        }
+      lock_release (&e->lock);
+
+      if (!dirty)
+        {
+          lock_acquire (&cache_lock);
+          cache_unpin (e);
+          lock_release (&cache_lock);
+        }
+    }
+  write_run (run, run_cnt);
+
+  lock_release (&flush_lock);
+}
+
+/* Prints buffer cache statistics. */
+void
+cache_print_stats (void)
+{
+  printf ("Buffer cache: %llu hits, %llu misses, %llu evictions, "
+          "%llu write-backs\n",
+          hit_cnt, miss_cnt, evict_cnt, writeback_cnt);
+  printf ("Buffer cache: %llu sectors read ahead, %llu of them used\n",
+          ra_load_cnt, ra_hit_cnt);
+}
+
+/* 周期性地把脏的缓存写回磁盘。 */
+static void
+flush_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (FLUSH_INTERVAL);
+      cache_flush ();
+    }
+}
+
+/* 不断从队列中取出请求，把扇区读入缓存。 */
+static void
+read_ahead_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      block_sector_t sector;
+      size_t cnt = 0;
+
+      /* 队首连续的请求合并为一次读入。 */
+      lock_acquire (&ra_lock);
+      while (ra_cnt == 0)
+        cond_wait (&ra_nonempty, &ra_lock);
+      sector = ra_queue[ra_head];
+      do
+        {
+          ra_head = (ra_head + 1) % READ_AHEAD_QUEUE;
+          ra_cnt--;
+          cnt++;
+        }
+      while (ra_cnt > 0 && cnt < RUN_MAX
+             && ra_queue[ra_head] == sector + cnt);
+      lock_release (&ra_lock);
+
+      load_run (sector, cnt, true);
+    }
+}
+
+/* 用clock算法选择一个没有被使用的条目，返回时该条目已写回磁盘。
+   没有可用条目时等待。必须持有cache_lock。 */
+static struct cache_entry *
+choose_victim (void)
+{
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  for (;;)
+    {
+      size_t i;
+
+      /* 转两圈：第一圈清除访问位，第二圈一定能找到未被使用的条目。 */
+      for (i = 0; i < 2 * CACHE_SIZE; i++)
+        {
+          struct cache_entry *e = &cache[clock_hand];
+          clock_hand = (clock_hand + 1) % CACHE_SIZE;
+
+          if (e->pin_cnt > 0 || e->uncommitted)
+            continue;
+          if (e->valid && e->accessed)
+            {
+              e->accessed = false;
+              continue;
+            }
+
+          if (e->valid)
+            {
+              evict_cnt++;
+              if (e->dirty)
+                {
+                  block_write (fs_device, e->sector, e->data);
+                  e->dirty = false;
+                  writeback_cnt++;
+                }
+            }
+          return e;
+        }
+      cond_wait (&cache_unpinned, &cache_lock);
+    }
+}
+
+/* 返回缓存SECTOR的条目，不在缓存中时返回空指针。
+   必须持有cache_lock。 */
+static struct cache_entry *
+cache_lookup (block_sector_t sector)
+{
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (cache[i].valid && cache[i].sector == sector)
+      return &cache[i];
+  return NULL;
+}
+
+/* 让choose_victim()选出的条目E缓存SECTOR，PREFETCH表示是否为
+   预读。固定E并获得它的锁。必须持有cache_lock。 */
+static void
+claim_entry (struct cache_entry *e, block_sector_t sector, bool prefetch)
+{
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  /* 条目没有被固定，所以获得它的锁不会阻塞，在释放cache_lock
+     之前获得它，其它线程就看不到未读入的内容。 */
+  e->sector = sector;
+  e->valid = true;
+  e->accessed = true;
+  e->prefetched = prefetch;
+  e->pin_cnt++;
+  lock_acquire (&e->lock);
+}
+
+/* 为不在缓存中的SECTOR替换一个条目，NEED_READ为真则从磁盘读入
+   内容。必须持有cache_lock，返回时已释放cache_lock，条目已被固定
+   且当前线程持有它的锁。 */
+static struct cache_entry *
+cache_load (block_sector_t sector, bool need_read)
+{
+  struct cache_entry *e;
+
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  e = choose_victim ();
+  claim_entry (e, sector, false);
+  lock_release (&cache_lock);
+
+  if (need_read)
+    block_read (fs_device, sector, e->data);
+  return e;
+}
+
+/* 返回缓存SECTOR的条目，条目已被固定且当前线程持有它的锁。
+   不在缓存中时替换一个条目，NEED_READ为真则从磁盘读入内容。 */
+static struct cache_entry *
+cache_get (block_sector_t sector, bool need_read)
+{
+  struct cache_entry *e;
+
+  lock_acquire (&cache_lock);
+  e = cache_lookup (sector);
+  if (e == NULL)
+    {
+      miss_cnt++;
+      return cache_load (sector, need_read);
+    }
+
+  hit_cnt++;
+  if (e->prefetched)
+    {
+      e->prefetched = false;
+      ra_hit_cnt++;
+    }
+  e->accessed = true;
+  e->pin_cnt++;
+  lock_release (&cache_lock);
+
+  lock_acquire (&e->lock);
+  return e;
+}
+
+/* 释放cache_get()返回的条目E。 */
+static void
+cache_put (struct cache_entry *e)
+{
+  lock_release (&e->lock);
+
+  lock_acquire (&cache_lock);
+  cache_unpin (e);
+  lock_release (&cache_lock);
+}
+
+/* 把从SECTOR开始的CNT个(不超过RUN_MAX)扇区中不在缓存中的读入
+   缓存，每段连续的缺失扇区用一次block_read_multi()读入。PREFETCH
+   表示是否为预读。 */
+static void
+load_run (block_sector_t sector, size_t cnt, bool prefetch)
+{
+  struct cache_entry *run[RUN_MAX];
+  size_t i = 0, n, k;
+
+  ASSERT (cnt <= RUN_MAX);
+
+  lock_acquire (&read_lock);
+  while (i < cnt)
+    {
+      /* 跳过已缓存的扇区，再为其后连续的缺失扇区各替换一个条目。
+         choose_victim()可能等待过，其间别的线程可能已经载入了
+         下一个扇区。 */
+      lock_acquire (&cache_lock);
+      while (i < cnt && cache_lookup (sector + i) != NULL)
+        i++;
+      for (n = 0; i + n < cnt && cache_lookup (sector + i + n) == NULL; n++)
+        {
+          struct cache_entry *e = choose_victim ();
+          if (cache_lookup (sector + i + n) != NULL)
+            break;
+          claim_entry (e, sector + i + n, prefetch);
+          run[n] = e;
+        }
+      if (prefetch)
+        ra_load_cnt += n;
+      else
+        miss_cnt += n;
+      lock_release (&cache_lock);
+
+      if (n > 0)
+        {
+          block_read_multi (fs_device, sector + i, n, read_buffer);
+          for (k = 0; k < n; k++)
+            {
+              memcpy (run[k]->data, read_buffer + k * BLOCK_SECTOR_SIZE,
+                      BLOCK_SECTOR_SIZE);
+              cache_put (run[k]);
+            }
+        }
+      i += n;
+    }
+  lock_release (&read_lock);
+}
+
+/* 把内容已复制到flush_buffer的CNT个扇区连续的条目RUN一次写回
+   磁盘，然后取消对它们的固定。 */
+static void
+write_run (struct cache_entry **run, size_t cnt)
+{
+  size_t i;
+
+  if (cnt == 0)
+    return;
+  block_write_multi (fs_device, run[0]->sector, cnt, flush_buffer);
+
+  lock_acquire (&cache_lock);
+  writeback_cnt += cnt;
+  for (i = 0; i < cnt; i++)
+    cache_unpin (run[i]);
+  lock_release (&cache_lock);
+}
+
+/* 取消对条目E的固定。必须持有cache_lock。 */
+static void
+cache_unpin (struct cache_entry *e)
+{
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+  ASSERT (e->pin_cnt > 0);
+
+  if (--e->pin_cnt == 0)
+    cond_signal (&cache_unpinned, &cache_lock);
+}
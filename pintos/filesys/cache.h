@@ -0,0 +1,20 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include "devices/block.h"
+
+/* Number of sectors in the buffer cache. */
+#define CACHE_SIZE 64
+
+void cache_init (void);
+void cache_read (block_sector_t, void *buffer, int ofs, int size);
+void cache_write (block_sector_t, const void *buffer, int ofs, int size);
+void cache_write_uncommitted (block_sector_t, const void *buffer,
+                              int ofs, int size);
+void cache_commit (block_sector_t);
+void cache_read_ahead (block_sector_t);
+void cache_prefetch (block_sector_t, size_t cnt);
+void cache_flush (void);
+void cache_print_stats (void);
+
+#endif /* filesys/cache.h */
@@ -0,0 +1,244 @@
+#include "filesys/dcache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "filesys/inode.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
+
+/* Dentry cache.
+
+   Caches the result of looking up a name in a directory, keyed
+   by the directory's inode sector and the name, so that a
+   repeated lookup neither opens nor reads the directory.  A name
+   that was looked up and not found is cached too, as a
+   "negative" entry.  At most DCACHE_SIZE names are cached; the
+   least recently used one is replaced when the cache is full.
+
+   The directory code keeps the cache up to date: dir_lookup()
+   fills it, dir_add() and dir_remove() replace the entry for the
+   name they change, and deleting a directory forgets every name
+   cached for it, since its sector may be reused.
+
+   dcache_open() opens the inode with dcache_lock held, so that a
+   file cannot be deleted, and its inode sector freed, between
+   finding the sector in the cache and opening it. */
+
+/* A cached name. */
+struct dentry
+  {
+    struct hash_elem hash_elem;         /* Element in dentries. */
+    struct list_elem lru_elem;          /* Element in lru_list. */
+    block_sector_t dir;                 /* 目录inode所在扇区 */
+    char name[NAME_MAX + 1];            /* 文件名 */
+    bool exists;                        /* 为false时是否定项 */
+    block_sector_t sector;              /* 存在时为文件inode所在扇区 */
+  };
+
+static struct hash dentries;            /* 以(dir, name)为键 */
+static struct list lru_list;            /* 最近使用的在前 */
+static struct lock dcache_lock;         /* 保护以上全部 */
+static struct kmem_cache *dentry_cache;
+
+/* Statistics. */
+static unsigned long long hit_cnt;      /* 命中肯定项的次数 */
+static unsigned long long negative_cnt; /* 命中否定项的次数 */
+static unsigned long long miss_cnt;     /* 未命中的次数 */
+static unsigned long long evict_cnt;    /* 因缓存已满替换的次数 */
+static unsigned long long invalidate_cnt; /* 因目录改变丢弃的次数 */
+
+static struct dentry *lookup (block_sector_t dir, const char *name);
+static void insert (block_sector_t dir, const char *name, bool exists,
+                    block_sector_t);
+static void discard (struct dentry *);
+static hash_hash_func dentry_hash;
+static hash_less_func dentry_less;
+
+/* Initializes the dentry cache. */
+void
+dcache_init (void)
+{
+  dentry_cache = kmem_cache_create ("dentry", sizeof (struct dentry), NULL);
+  if (dentry_cache == NULL
+      || !hash_init (&dentries, dentry_hash, dentry_less, NULL))
+    PANIC ("dentry cache creation failed");
+  list_init (&lru_list);
+  lock_init (&dcache_lock);
+  lock_set_name (&dcache_lock, "dcache");
+}
+
+/* Looks up NAME in the directory whose inode is in sector DIR.
+   Returns DCACHE_FOUND if the cache knows that NAME exists, and
+   sets *INODE to an inode for it, which the caller must close
+   (or to a null pointer if memory allocation fails).  Returns
+   DCACHE_ABSENT if the cache knows that NAME does not exist, and
+   DCACHE_MISS if the directory must be searched.  In the last
+   two cases *INODE is set to a null pointer. */
+enum dcache_result
+dcache_open (block_sector_t dir, const char *name, struct inode **inode)
+{
+  enum dcache_result result = DCACHE_MISS;
+  struct dentry *d;
+
+  *inode = NULL;
+  if (strlen (name) > NAME_MAX)
+    return DCACHE_MISS;
+
+  lock_acquire (&dcache_lock);
+  d = lookup (dir, name);
+  if (d == NULL)
+    miss_cnt++;
+  else
+    {
+      list_remove (&d->lru_elem);
+      list_push_front (&lru_list, &d->lru_elem);
+      if (d->exists)
+        {
+          hit_cnt++;
+          *inode = inode_open (d->sector);
+          result = DCACHE_FOUND;
+        }
+      else
+        {
+          negative_cnt++;
+          result = DCACHE_ABSENT;
+        }
+    }
+  lock_release (&dcache_lock);
+
+  return result;
+}
+
+/* Records that NAME, in the directory whose inode is in sector
+   DIR, refers to the inode in SECTOR. */
+void
+dcache_add (block_sector_t dir, const char *name, block_sector_t sector)
+{
+  insert (dir, name, true, sector);
+}
+
+/* Records that there is no file named NAME in the directory whose
+   inode is in sector DIR. */
+void
+dcache_add_absent (block_sector_t dir, const char *name)
+{
+  insert (dir, name, false, 0);
+}
+
+/* Forgets every name cached for the directory whose inode is in
+   sector DIR.  Called when an inode is deleted, in case it is a
+   directory. */
+void
+dcache_forget_dir (block_sector_t dir)
+{
+  struct list_elem *e;
+
+  lock_acquire (&dcache_lock);
+  for (e = list_begin (&lru_list); e != list_end (&lru_list); )
+    {
+      struct dentry *d = list_entry (e, struct dentry, lru_elem);
+      e = list_next (e);
+      if (d->dir == dir)
+        {
+          discard (d);
+          invalidate_cnt++;
+        }
+    }
+  lock_release (&dcache_lock);
+}
+
+/* Prints dentry cache statistics. */
+void
+dcache_print_stats (void)
+{
+  printf ("Dentry cache: %llu hits, %llu negative hits, %llu misses, "
+          "%llu evictions, %llu invalidations\n",
+          hit_cnt, negative_cnt, miss_cnt, evict_cnt, invalidate_cnt);
+}
+
+/* 返回(DIR, NAME)的缓存项，没有则返回NULL。必须持有dcache_lock */
+static struct dentry *
+lookup (block_sector_t dir, const char *name)
+{
+  struct dentry key;
+  struct hash_elem *e;
+
+  key.dir = dir;
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&dentries, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct dentry, hash_elem) : NULL;
+}
+
+/* 记录(DIR, NAME)的查找结果，替换已有的缓存项。
+   缓存已满时替换最久未用的项，内存不足时什么也不做 */
+static void
+insert (block_sector_t dir, const char *name, bool exists,
+        block_sector_t sector)
+{
+  struct dentry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return;
+
+  lock_acquire (&dcache_lock);
+  d = lookup (dir, name);
+  if (d != NULL)
+    {
+      if (d->exists != exists || d->sector != sector)
+        invalidate_cnt++;
+      list_remove (&d->lru_elem);
+    }
+  else
+    {
+      if (hash_size (&dentries) >= DCACHE_SIZE)
+        {
+          discard (list_entry (list_back (&lru_list),
+                               struct dentry, lru_elem));
+          evict_cnt++;
+        }
+      d = kmem_cache_alloc (dentry_cache);
+      if (d == NULL)
+        goto done;
+      d->dir = dir;
+      strlcpy (d->name, name, sizeof d->name);
+      hash_insert (&dentries, &d->hash_elem);
+    }
+  d->exists = exists;
+  d->sector = sector;
+  list_push_front (&lru_list, &d->lru_elem);
+
+ done:
+  lock_release (&dcache_lock);
+}
+
+/* 从缓存中删除并释放D。必须持有dcache_lock */
+static void
+discard (struct dentry *d)
+{
+  hash_delete (&dentries, &d->hash_elem);
+  list_remove (&d->lru_elem);
+  kmem_cache_free (dentry_cache, d);
+}
+
+/* 以(dir, name)为键的哈希函数 */
+static unsigned
+dentry_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct dentry *d = hash_entry (e, struct dentry, hash_elem);
+  return hash_string (d->name) ^ hash_int (d->dir);
+}
+
+/* 按(dir, name)比较 */
+static bool
+dentry_less (const struct hash_elem *a_, const struct hash_elem *b_,
+             void *aux UNUSED)
+{
+  const struct dentry *a = hash_entry (a_, struct dentry, hash_elem);
+  const struct dentry *b = hash_entry (b_, struct dentry, hash_elem);
+  if (a->dir != b->dir)
+    return a->dir < b->dir;
+  return strcmp (a->name, b->name) < 0;
+}
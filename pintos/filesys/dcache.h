@@ -0,0 +1,28 @@
+#ifndef FILESYS_DCACHE_H
+#define FILESYS_DCACHE_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+
+struct inode;
+
+/* Number of names the dentry cache holds. */
+#define DCACHE_SIZE 256
+
+/* Result of a dentry cache lookup. */
+enum dcache_result
+  {
+    DCACHE_MISS,                /* Not cached; look in the directory. */
+    DCACHE_FOUND,               /* Cached: the name exists. */
+    DCACHE_ABSENT               /* Cached: the name does not exist. */
+  };
+
+void dcache_init (void);
+enum dcache_result dcache_open (block_sector_t dir, const char *name,
+                                struct inode **);
+void dcache_add (block_sector_t dir, const char *name, block_sector_t);
+void dcache_add_absent (block_sector_t dir, const char *name);
+void dcache_forget_dir (block_sector_t dir);
+void dcache_print_stats (void);
+
+#endif /* filesys/dcache.h */
@@ -1,16 +1,42 @@
 #include "filesys/directory.h"
+#include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
+
+/* Every directory that is open, and a few that were open
+   recently, has an in-memory index of its entries, shared by all
+   the `struct dir's open on it.  The index is built by reading
+   the whole directory once, when it is first opened.  It maps
+   each name in use to its entry through a hash table, so that
+   looking up, adding, or removing a name does not read the
+   directory, and keeps the free entry slots in order of offset,
+   so that dir_add() fills the first free slot just as a scan of
+   the directory would.  dir_readdir() still reads the directory
+   itself in order of offset, so it sees the same order as
+   before.
+
+   The index also serializes changes to the directory: dir_add(),
+   dir_remove(), and dir_lookup() hold its lock.  They also keep
+   the dentry cache (see dcache.c) up to date. */
+
+/* Number of indexes kept for directories that are not open. */
+#define IDLE_INDEX_MAX 8
 
 /* A directory. */
 struct dir 
   {
     struct inode *inode;                /* Backing store. */
     off_t pos;                          /* Current position. */
+    struct dir_index *index;            /* 目录项索引 */
   };
 
 /* A single directory entry. */
@@ -21,12 +47,84 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
+/* In-memory index of one directory's entries. */
+struct dir_index
+  {
+    struct list_elem elem;              /* Element in dir_indexes. */
+    block_sector_t sector;              /* 目录inode所在扇区 */
+    int open_cnt;                       /* 使用它的struct dir数 */
+    bool removed;                       /* 目录已被删除，不再使用时丢弃 */
+    struct lock lock;                   /* 保护以下成员和目录内容 */
+    struct hash slots;                  /* 使用中的目录项，以名字为键 */
+    struct list free_slots;             /* 空闲的目录项，按偏移排序 */
+    off_t end;                          /* 最后一个目录项之后的偏移 */
+  };
+
+/* One entry slot of a directory, in use or free. */
+struct dir_slot
+  {
+    struct hash_elem hash_elem;         /* Element in slots, if in use. */
+    struct list_elem free_elem;         /* Element in free_slots, if free. */
+    off_t ofs;                          /* 目录项在目录中的偏移 */
+    block_sector_t inode_sector;        /* 使用中时为文件inode所在扇区 */
+    char name[NAME_MAX + 1];            /* 使用中时为文件名 */
+  };
+
+/* Caches of `struct dir's and `struct dir_slot's. */
+static struct kmem_cache *dir_cache;
+static struct kmem_cache *slot_cache;
+
+/* All directory indexes, most recently opened first. */
+static struct list dir_indexes;
+static struct lock dir_indexes_lock;    /* 保护dir_indexes和idle_cnt */
+static size_t idle_cnt;                 /* open_cnt为0的索引数 */
+
+static struct dir_index *index_get (struct inode *);
+static void index_put (struct dir_index *);
+static void index_forget (block_sector_t);
+static hash_hash_func slot_hash;
+static hash_less_func slot_less;
+
+/* Initializes the directory module. */
+void
+dir_init (void)
+{
+  dir_cache = kmem_cache_create ("dir", sizeof (struct dir), NULL);
+  slot_cache = kmem_cache_create ("dir slot", sizeof (struct dir_slot), NULL);
+  if (dir_cache == NULL || slot_cache == NULL)
+    PANIC ("dir cache creation failed");
+  list_init (&dir_indexes);
+  lock_init (&dir_indexes_lock);
+  lock_set_name (&dir_indexes_lock, "dir indexes");
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
    given SECTOR.  Returns true if successful, false on failure. */
 bool
 dir_create (block_sector_t sector, size_t entry_cnt)
 {
-  return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+  off_t size = entry_cnt * sizeof (struct dir_entry);
+  struct inode *inode;
+  void *zeros;
+  bool success = false;
+
+  /* The sectors inode_create() zeroes are not journaled, so
+     write the empty entries again through the journal. */
+  journal_begin ();
+  zeros = calloc (1, size > 0 ? size : 1);
+  if (zeros != NULL && inode_create (sector, size))
+    {
+      inode = inode_open (sector);
+      if (inode != NULL)
+        {
+          inode_set_metadata (inode);
+          success = inode_write_at (inode, zeros, size, 0) == size;
+          inode_close (inode);
+        }
+    }
+  free (zeros);
+  journal_end ();
+  return success;
 }
 
 /* Opens and returns the directory for the given INODE, of which
@@ -34,9 +132,11 @@ dir_create (block_sector_t sector, size_t entry_cnt)
 struct dir *
 dir_open (struct inode *inode) 
 {
-  struct dir *dir = calloc (1, sizeof *dir);
-  if (inode != NULL && dir != NULL)
+  struct dir *dir = kmem_cache_alloc (dir_cache);
+  if (inode != NULL && dir != NULL
+      && (dir->index = index_get (inode)) != NULL)
     {
+      inode_set_metadata (inode);
       dir->inode = inode;
       dir->pos = 0;
       return dir;
@@ -44,7 +144,7 @@ dir_open (struct inode *inode)
   else
     {
       inode_close (inode);
-      free (dir);
+      kmem_cache_free (dir_cache, dir);
       return NULL; 
     }
 }
@@ -71,8 +171,9 @@ dir_close (struct dir *dir)
 {
   if (dir != NULL)
     {
+      index_put (dir->index);
       inode_close (dir->inode);
-      free (dir);
+      kmem_cache_free (dir_cache, dir);
     }
 }
 
@@ -83,32 +184,21 @@ dir_get_inode (struct dir *dir)
   return dir->inode;
 }
 
-/* Searches DIR for a file with the given NAME.
-   If successful, returns true, sets *EP to the directory entry
-   if EP is non-null, and sets *OFSP to the byte offset of the
-   directory entry if OFSP is non-null.
-   otherwise, returns false and ignores EP and OFSP. */
-static bool
-lookup (const struct dir *dir, const char *name,
-        struct dir_entry *ep, off_t *ofsp) 
+/* Returns the slot for the entry named NAME in DIR, or a null
+   pointer if there is none.  DIR's index must be locked. */
+static struct dir_slot *
+lookup (const struct dir *dir, const char *name) 
 {
-  struct dir_entry e;
-  size_t ofs;
+  struct dir_slot key;
+  struct hash_elem *e;
   
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
+  ASSERT (lock_held_by_current_thread (&dir->index->lock));
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (e.in_use && !strcmp (name, e.name)) 
-      {
-        if (ep != NULL)
-          *ep = e;
-        if (ofsp != NULL)
-          *ofsp = ofs;
-        return true;
-      }
-  return false;
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&dir->index->slots, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct dir_slot, hash_elem) : NULL;
 }
 
 /* Searches DIR for a file with the given NAME
@@ -119,15 +209,25 @@ bool
 dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode) 
 {
-  struct dir_entry e;
+  struct dir_slot *slot;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
-    *inode = inode_open (e.inode_sector);
+  *inode = NULL;
+  if (strlen (name) > NAME_MAX)
+    return false;
+
+  lock_acquire (&dir->index->lock);
+  slot = lookup (dir, name);
+  if (slot != NULL)
+    {
+      *inode = inode_open (slot->inode_sector);
+      dcache_add (dir->index->sector, name, slot->inode_sector);
+    }
   else
-    *inode = NULL;
+    dcache_add_absent (dir->index->sector, name);
+  lock_release (&dir->index->lock);
 
   return *inode != NULL;
 }
@@ -141,8 +241,10 @@ dir_lookup (const struct dir *dir, const char *name,
 bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 {
+  struct dir_index *index;
+  struct dir_slot *slot;
   struct dir_entry e;
-  off_t ofs;
+  bool append;
   bool success = false;
 
   ASSERT (dir != NULL);
@@ -152,29 +254,55 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
+  index = dir->index;
+  journal_begin ();
+  lock_acquire (&index->lock);
+
   /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
+  if (lookup (dir, name) != NULL)
     goto done;
 
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
-     
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
-      break;
+  /* Take the first free slot.
+     If there are no free slots, then append a new one at the
+     current end-of-file. */
+  append = list_empty (&index->free_slots);
+  if (append)
+    {
+      slot = kmem_cache_alloc (slot_cache);
+      if (slot == NULL)
+        goto done;
+      slot->ofs = index->end;
+    }
+  else
+    slot = list_entry (list_front (&index->free_slots),
+                       struct dir_slot, free_elem);
 
   /* Write slot. */
+  memset (&e, 0, sizeof e);
   e.in_use = true;
   strlcpy (e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
-  success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  if (inode_write_at (dir->inode, &e, sizeof e, slot->ofs) != sizeof e)
+    {
+      if (append)
+        kmem_cache_free (slot_cache, slot);
+      goto done;
+    }
+
+  /* Index slot. */
+  if (append)
+    index->end += sizeof e;
+  else
+    list_remove (&slot->free_elem);
+  strlcpy (slot->name, name, sizeof slot->name);
+  slot->inode_sector = inode_sector;
+  hash_insert (&index->slots, &slot->hash_elem);
+  dcache_add (index->sector, name, inode_sector);
+  success = true;
 
  done:
+  lock_release (&index->lock);
+  journal_end ();
   return success;
 }
 
@@ -184,34 +312,58 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 bool
 dir_remove (struct dir *dir, const char *name) 
 {
+  struct dir_index *index = dir->index;
+  struct dir_slot *slot;
   struct dir_entry e;
   struct inode *inode = NULL;
+  struct list_elem *x;
   bool success = false;
-  off_t ofs;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  if (strlen (name) > NAME_MAX)
+    return false;
+  journal_begin ();
+  lock_acquire (&index->lock);
+
   /* Find directory entry. */
-  if (!lookup (dir, name, &e, &ofs))
+  slot = lookup (dir, name);
+  if (slot == NULL)
     goto done;
 
   /* Open inode. */
-  inode = inode_open (e.inode_sector);
+  inode = inode_open (slot->inode_sector);
   if (inode == NULL)
     goto done;
 
   /* Erase directory entry. */
+  memset (&e, 0, sizeof e);
+  e.inode_sector = slot->inode_sector;
+  strlcpy (e.name, slot->name, sizeof e.name);
   e.in_use = false;
-  if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
+  if (inode_write_at (dir->inode, &e, sizeof e, slot->ofs) != sizeof e) 
     goto done;
 
+  /* Move slot to the free list, keeping it in order. */
+  hash_delete (&index->slots, &slot->hash_elem);
+  for (x = list_begin (&index->free_slots);
+       x != list_end (&index->free_slots); x = list_next (x))
+    if (list_entry (x, struct dir_slot, free_elem)->ofs > slot->ofs)
+      break;
+  list_insert (x, &slot->free_elem);
+
   /* Remove inode. */
+  dcache_add_absent (index->sector, name);
+  dcache_forget_dir (e.inode_sector);
+  index_forget (e.inode_sector);
   inode_remove (inode);
   success = true;
 
  done:
+  lock_release (&index->lock);
   inode_close (inode);
+  journal_end ();
   return success;
 }
 
@@ -222,15 +374,205 @@ bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
   struct dir_entry e;
+  bool success = false;
 
+  lock_acquire (&dir->index->lock);
   while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
     {
       dir->pos += sizeof e;
       if (e.in_use)
         {
           strlcpy (name, e.name, NAME_MAX + 1);
-          return true;
+          success = true;
+          break;
         } 
     }
-  return false;
+  lock_release (&dir->index->lock);
+  return success;
+}
+
+/* 释放一个使用中的目录项，用于hash_destroy() */
+static void
+slot_destroy (struct hash_elem *e, void *aux UNUSED)
+{
+  kmem_cache_free (slot_cache, hash_entry (e, struct dir_slot, hash_elem));
+}
+
+/* 释放INDEX及其所有目录项 */
+static void
+index_free (struct dir_index *index)
+{
+  while (!list_empty (&index->free_slots))
+    kmem_cache_free (slot_cache,
+                     list_entry (list_pop_front (&index->free_slots),
+                                 struct dir_slot, free_elem));
+  hash_destroy (&index->slots, slot_destroy);
+  free (index);
+}
+
+/* 读取目录INODE的全部目录项，建立新的索引。内存不足时返回NULL */
+static struct dir_index *
+index_build (struct inode *inode)
+{
+  struct dir_entry entries[16];
+  struct dir_index *index;
+  off_t ofs = 0;
+
+  index = malloc (sizeof *index);
+  if (index == NULL)
+    return NULL;
+  if (!hash_init (&index->slots, slot_hash, slot_less, NULL))
+    {
+      free (index);
+      return NULL;
+    }
+  index->sector = inode_get_inumber (inode);
+  index->open_cnt = 1;
+  index->removed = false;
+  lock_init (&index->lock);
+  list_init (&index->free_slots);
+
+  for (;;)
+    {
+      off_t size = inode_read_at (inode, entries, sizeof entries, ofs);
+      size_t cnt = size / sizeof *entries;
+      size_t i;
+
+      for (i = 0; i < cnt; i++, ofs += sizeof *entries)
+        {
+          struct dir_slot *slot = kmem_cache_alloc (slot_cache);
+          if (slot == NULL)
+            {
+              index_free (index);
+              return NULL;
+            }
+          slot->ofs = ofs;
+          slot->inode_sector = entries[i].inode_sector;
+          strlcpy (slot->name, entries[i].name, sizeof slot->name);
+          if (!entries[i].in_use)
+            list_push_back (&index->free_slots, &slot->free_elem);
+          else if (hash_insert (&index->slots, &slot->hash_elem) != NULL)
+            {
+              /* 重名的目录项，和逐项查找时一样只用第一个 */
+              kmem_cache_free (slot_cache, slot);
+            }
+        }
+      if (size < (off_t) sizeof entries)
+        break;
+    }
+  index->end = ofs;
+  return index;
+}
+
+/* 释放多出的不再使用的索引，从最久未打开的开始。
+   必须持有dir_indexes_lock */
+static void
+index_trim (void)
+{
+  struct list_elem *e = list_rbegin (&dir_indexes);
+
+  while (idle_cnt > IDLE_INDEX_MAX && e != list_rend (&dir_indexes))
+    {
+      struct dir_index *index = list_entry (e, struct dir_index, elem);
+      e = list_prev (e);
+      if (index->open_cnt == 0)
+        {
+          list_remove (&index->elem);
+          index_free (index);
+          idle_cnt--;
+        }
+    }
+}
+
+/* 返回目录INODE的索引，没有则建立一个。内存不足时返回NULL */
+static struct dir_index *
+index_get (struct inode *inode)
+{
+  block_sector_t sector = inode_get_inumber (inode);
+  struct dir_index *index = NULL;
+  struct list_elem *e;
+
+  lock_acquire (&dir_indexes_lock);
+  for (e = list_begin (&dir_indexes); e != list_end (&dir_indexes);
+       e = list_next (e))
+    if (list_entry (e, struct dir_index, elem)->sector == sector)
+      {
+        index = list_entry (e, struct dir_index, elem);
+        if (index->open_cnt++ == 0)
+          idle_cnt--;
+        list_remove (&index->elem);
+        break;
+      }
+  if (index == NULL)
+    index = index_build (inode);
+  if (index != NULL)
+    list_push_front (&dir_indexes, &index->elem);
+  lock_release (&dir_indexes_lock);
+
+  return index;
+}
+
+/* 释放由index_get()取得的INDEX */
+static void
+index_put (struct dir_index *index)
+{
+  lock_acquire (&dir_indexes_lock);
+  if (--index->open_cnt == 0)
+    {
+      if (index->removed)
+        {
+          list_remove (&index->elem);
+          index_free (index);
+        }
+      else
+        {
+          idle_cnt++;
+          index_trim ();
+        }
+    }
+  lock_release (&dir_indexes_lock);
+}
+
+/* 扇区SECTOR中的inode被删除了。若它是目录，丢弃它的索引，
+   以免这个扇区被重新使用后又用到旧的索引 */
+static void
+index_forget (block_sector_t sector)
+{
+  struct list_elem *e;
+
+  lock_acquire (&dir_indexes_lock);
+  for (e = list_begin (&dir_indexes); e != list_end (&dir_indexes);
+       e = list_next (e))
+    {
+      struct dir_index *index = list_entry (e, struct dir_index, elem);
+      if (index->sector == sector)
+        {
+          if (index->open_cnt == 0)
+            {
+              list_remove (&index->elem);
+              index_free (index);
+              idle_cnt--;
+            }
+          else
+            index->removed = true;
+          break;
+        }
+    }
+  lock_release (&dir_indexes_lock);
+}
+
+/* 以文件名为键的哈希函数 */
+static unsigned
+slot_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_string (hash_entry (e, struct dir_slot, hash_elem)->name);
+}
+
+/* 按文件名比较 */
+static bool
+slot_less (const struct hash_elem *a, const struct hash_elem *b,
+           void *aux UNUSED)
+{
+  return strcmp (hash_entry (a, struct dir_slot, hash_elem)->name,
+                 hash_entry (b, struct dir_slot, hash_elem)->name) < 0;
 }
@@ -1,7 +1,14 @@
 #include "filesys/file.h"
 #include <debug.h>
 #include "filesys/inode.h"
-#include "threads/malloc.h"
+#include "devices/block.h"
+#include "threads/slab.h"
+
+/* Read-ahead window, in sectors: the first sequential read
+   reads ahead READ_AHEAD_MIN sectors, and each further one
+   doubles the window up to READ_AHEAD_MAX. */
+#define READ_AHEAD_MIN 2
+#define READ_AHEAD_MAX 16
 
 /* An open file. */
 struct file 
@@ -9,26 +16,46 @@ struct file
     struct inode *inode;        /* File's inode. */
     off_t pos;                  /* Current position. */
     bool deny_write;            /* Has file_deny_write() been called? */
+    off_t ra_next;              /* 顺序读时下一次读开始的位置 */
+    off_t ra_end;               /* 已请求预读到的位置 */
+    int ra_window;              /* 预读窗口的扇区数，0表示不预读 */
   };
 
+static void read_ahead (struct file *, off_t old_pos);
+
+/* Cache of `struct file's. */
+static struct kmem_cache *file_cache;
+
+/* Initializes the file module. */
+void
+file_init (void)
+{
+  file_cache = kmem_cache_create ("file", sizeof (struct file), NULL);
+  if (file_cache == NULL)
+    PANIC ("file cache creation failed");
+}
+
 /* Opens a file for the given INODE, of which it takes ownership,
    and returns the new file.  Returns a null pointer if an
    allocation fails or if INODE is null. */
 struct file *
 file_open (struct inode *inode) 
 {
-  struct file *file = calloc (1, sizeof *file);
+  struct file *file = kmem_cache_alloc (file_cache);
   if (inode != NULL && file != NULL)
     {
       file->inode = inode;
       file->pos = 0;
       file->deny_write = false;
+      file->ra_next = 0;
+      file->ra_end = 0;
+      file->ra_window = 0;
       return file;
     }
   else
     {
       inode_close (inode);
-      free (file);
+      kmem_cache_free (file_cache, file);
       return NULL; 
     }
 }
@@ -49,7 +76,7 @@ file_close (struct file *file)
     {
       file_allow_write (file);
       inode_close (file->inode);
-      free (file); 
+      kmem_cache_free (file_cache, file);
     }
 }
 
@@ -64,12 +91,15 @@ file_get_inode (struct file *file)
    starting at the file's current position.
    Returns the number of bytes actually read,
    which may be less than SIZE if end of file is reached.
-   Advances FILE's position by the number of bytes read. */
+   Advances FILE's position by the number of bytes read.
+   Sequential reads make the buffer cache read ahead. */
 off_t
 file_read (struct file *file, void *buffer, off_t size) 
 {
+  off_t old_pos = file->pos;
   off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
   file->pos += bytes_read;
+  read_ahead (file, old_pos);
   return bytes_read;
 }
 
@@ -87,9 +117,8 @@ file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs)
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at the file's current position.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk is full.
+   Writing past end of file grows the file.
    Advances FILE's position by the number of bytes read. */
 off_t
 file_write (struct file *file, const void *buffer, off_t size) 
@@ -102,9 +131,8 @@ file_write (struct file *file, const void *buffer, off_t size)
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at offset FILE_OFS in the file.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk is full.
+   Writing past end of file grows the file.
    The file's current position is unaffected. */
 off_t
 file_write_at (struct file *file, const void *buffer, off_t size,
@@ -166,3 +194,34 @@ file_tell (struct file *file)
   ASSERT (file != NULL);
   return file->pos;
 }
+
+/* 在file_read()之后调用，OLD_POS为这次读开始的位置。如果这次读
+   接着上次读的位置（或从文件开头读），就扩大预读窗口，并请求预读
+   FILE当前位置之后窗口内尚未预读的扇区；否则关闭预读。 */
+static void
+read_ahead (struct file *file, off_t old_pos)
+{
+  off_t start, end;
+
+  if (old_pos != file->ra_next)
+    file->ra_window = 0;
+  else if (file->ra_window == 0)
+    file->ra_window = READ_AHEAD_MIN;
+  else if (file->ra_window < READ_AHEAD_MAX)
+    file->ra_window *= 2;
+  file->ra_next = file->pos;
+
+  if (file->ra_window == 0)
+    {
+      file->ra_end = file->pos;
+      return;
+    }
+
+  start = file->ra_end > file->pos ? file->ra_end : file->pos;
+  end = file->pos + file->ra_window * BLOCK_SECTOR_SIZE;
+  if (start < end)
+    {
+      inode_read_ahead (file->inode, start, end - start);
+      file->ra_end = end;
+    }
+}
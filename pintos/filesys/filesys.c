@@ -2,9 +2,12 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
+#include "filesys/dcache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
 #include "filesys/directory.h"
 
 /* Partition that contains the file system. */
@@ -21,8 +24,13 @@ filesys_init (bool format)
   if (fs_device == NULL)
     PANIC ("No file system device found, can't initialize file system.");
 
+  cache_init ();
   inode_init ();
+  file_init ();
+  dir_init ();
+  dcache_init ();
   free_map_init ();
+  journal_init (format);
 
   if (format) 
     do_format ();
@@ -36,6 +44,8 @@ void
 filesys_done (void) 
 {
   free_map_close ();
+  journal_flush ();
+  cache_flush ();
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
@@ -47,12 +57,16 @@ filesys_create (const char *name, off_t initial_size)
 {
   block_sector_t inode_sector = 0;
   struct dir *dir = dir_open_root ();
-  bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size)
-                  && dir_add (dir, name, inode_sector));
+  bool success;
+
+  journal_begin ();
+  success = (dir != NULL
+             && free_map_allocate (1, &inode_sector)
+             && inode_create (inode_sector, initial_size)
+             && dir_add (dir, name, inode_sector));
   if (!success && inode_sector != 0) 
     free_map_release (inode_sector, 1);
+  journal_end ();
   dir_close (dir);
 
   return success;
@@ -66,9 +80,14 @@ filesys_create (const char *name, off_t initial_size)
 struct file *
 filesys_open (const char *name)
 {
-  struct dir *dir = dir_open_root ();
-  struct inode *inode = NULL;
+  struct dir *dir;
+  struct inode *inode;
 
+  /* Try the dentry cache before opening the directory. */
+  if (dcache_open (ROOT_DIR_SECTOR, name, &inode) != DCACHE_MISS)
+    return file_open (inode);
+
+  dir = dir_open_root ();
   if (dir != NULL)
     dir_lookup (dir, name, &inode);
   dir_close (dir);
@@ -84,7 +103,11 @@ bool
 filesys_remove (const char *name) 
 {
   struct dir *dir = dir_open_root ();
-  bool success = dir != NULL && dir_remove (dir, name);
+  bool success;
+
+  journal_begin ();
+  success = dir != NULL && dir_remove (dir, name);
+  journal_end ();
   dir_close (dir); 
 
   return success;
@@ -1,68 +1,275 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <hash.h>
+#include <list.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
+
+/* The free map is kept on disk as a bitmap, one bit per sector,
+   in the free map file.  The in-memory bitmap is the
+   authoritative copy, but allocation does not search it.
+   Instead, every maximal run of free sectors (a "free extent")
+   is also kept in an index that can be searched both by size
+   and by address:
+
+     - A list of all free extents in order of address, used to
+       find the first free sector at or after a given sector.
+
+     - One list per size class, class K holding the extents of
+       2**K to 2**(K+1) - 1 sectors, so that an extent of at
+       least a given size is found without looking at smaller
+       ones.
+
+     - Two hash tables, keyed by the first sector of each extent
+       and by the sector just past its end.  Freeing a run of
+       sectors finds the extents on either side of it in these
+       and merges with them in constant time.
+
+   free_map_allocate() is next fit: it first tries to continue in
+   the extent that the last allocation was taken from, which
+   keeps inodes and index blocks created one after another
+   together, and otherwise takes the first extent big enough from
+   the smallest size class that can hold the request.
+
+   A run of sectors can also be reserved for a growing file with
+   free_map_reserve().  That takes the run out of the index but
+   leaves it free in the bitmap, so a reservation costs no disk
+   write and is forgotten by a crash; only sectors later claimed
+   with free_map_claim() are marked used on disk.
+
+   When the bitmap changes, only the sectors of the free map file
+   that hold the changed bits are written back, instead of the
+   whole file. */
+
+/* Number of size classes.  Class K holds extents of 2**K to
+   2**(K+1) - 1 sectors; the last class holds everything
+   bigger. */
+#define CLASS_CNT 24
+
+/* Number of bitmap bits in one sector of the free map file. */
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * 8)
+
+/* A run of consecutive free sectors. */
+struct free_extent
+  {
+    block_sector_t start;               /* First sector. */
+    size_t cnt;                         /* Number of sectors. */
+    struct list_elem addr_elem;         /* 在按地址排序的链表中 */
+    struct list_elem size_elem;         /* 在所属大小类的链表中 */
+    struct hash_elem start_elem;        /* 以start为键 */
+    struct hash_elem end_elem;          /* 以start + cnt为键 */
+  };
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
+static struct lock free_map_lock;    /* 文件可以增长后，多个线程会同时分配扇区 */
+
+/* Free extent index.  Protected by free_map_lock. */
+static struct list extents;                  /* 所有空闲区段，按地址排序 */
+static struct list size_classes[CLASS_CNT];  /* 每个大小类的空闲区段 */
+static struct hash extents_by_start;         /* 以首扇区为键 */
+static struct hash extents_by_end;           /* 以末扇区的下一个扇区为键 */
+static struct kmem_cache *extent_cache;      /* struct free_extent的来源 */
+static block_sector_t next_fit;              /* 上次分配结束的位置 */
+
+/* Sectors of the free map file that hold bits changed since it
+   was last written.  Empty if dirty_lo > dirty_hi. */
+static size_t dirty_lo, dirty_hi;
+
+static void index_build (void);
+static void index_insert (block_sector_t, size_t cnt);
+static bool index_take (struct free_extent *, block_sector_t, size_t cnt);
+static struct free_extent *find_fit (size_t cnt);
+static struct free_extent *find_near (block_sector_t goal);
+static void map_set (block_sector_t, size_t cnt, bool value);
+static bool map_flush (void);
+static hash_hash_func start_hash, end_hash;
+static hash_less_func start_less, end_less;
 
 /* Initializes the free map. */
 void
-free_map_init (void) 
+free_map_init (void)
 {
+  size_t i;
+
+  lock_init (&free_map_lock);
+  lock_set_name (&free_map_lock, "free map");
   free_map = bitmap_create (block_size (fs_device));
   if (free_map == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  if (block_size (fs_device) < JOURNAL_SECTOR + JOURNAL_SECTORS)
+    PANIC ("file system device too small for journal");
+  bitmap_set_multiple (free_map, JOURNAL_SECTOR, JOURNAL_SECTORS, true);
+  dirty_lo = 1;
+  dirty_hi = 0;
+
+  list_init (&extents);
+  for (i = 0; i < CLASS_CNT; i++)
+    list_init (&size_classes[i]);
+  extent_cache = kmem_cache_create ("free extent",
+                                    sizeof (struct free_extent), NULL);
+  if (extent_cache == NULL
+      || !hash_init (&extents_by_start, start_hash, start_less, NULL)
+      || !hash_init (&extents_by_end, end_hash, end_less, NULL))
+    PANIC ("free extent index creation failed");
+  index_build ();
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
    the first into *SECTORP.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available or if the free_map file could not be
+   written. */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  struct free_extent *e;
+  block_sector_t sector = BITMAP_ERROR;
+
+  journal_begin ();
+  lock_acquire (&free_map_lock);
+  e = find_fit (cnt);
+  if (e != NULL)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      sector = e->start;
+      index_take (e, sector, cnt);
+      map_set (sector, cnt, true);
+      if (!map_flush ())
+        {
+          map_set (sector, cnt, false);
+          index_insert (sector, cnt);
+          sector = BITMAP_ERROR;
+        }
+      else
+        next_fit = sector + cnt;
     }
+  lock_release (&free_map_lock);
+  journal_end ();
   if (sector != BITMAP_ERROR)
     *sectorp = sector;
   return sector != BITMAP_ERROR;
 }
 
-/* Makes CNT sectors starting at SECTOR available for use. */
+/* Reserves a run of free sectors, at most MAX_CNT long, that
+   starts at the first free sector at or after GOAL (or, if there
+   is none, the first free sector on the disk).  Stores the first
+   sector into *SECTORP and the length of the run into *CNTP.
+   Returns true if successful, false if the disk is full.
+
+   Reserved sectors are only taken out of the in-memory free
+   extent index, so other allocations skip them, but they stay
+   free in the bitmap and nothing is written to disk or to the
+   journal.  Each sector must be claimed with free_map_claim()
+   before it is used and the rest given back with
+   free_map_unreserve(); after a crash they are simply free. */
+bool
+free_map_reserve (block_sector_t goal, size_t max_cnt,
+                  block_sector_t *sectorp, size_t *cntp)
+{
+  struct free_extent *e;
+  block_sector_t sector = BITMAP_ERROR;
+  size_t cnt = 0;
+
+  ASSERT (max_cnt > 0);
+
+  lock_acquire (&free_map_lock);
+  e = find_near (goal);
+  if (e != NULL)
+    {
+      sector = goal > e->start && goal < e->start + e->cnt ? goal : e->start;
+      cnt = e->start + e->cnt - sector;
+      if (cnt > max_cnt)
+        cnt = max_cnt;
+      if (!index_take (e, sector, cnt))
+        {
+          /* No memory to split E in two: take its head instead. */
+          sector = e->start;
+          index_take (e, sector, cnt);
+        }
+    }
+  lock_release (&free_map_lock);
+
+  if (sector == BITMAP_ERROR)
+    return false;
+  *sectorp = sector;
+  *cntp = cnt;
+  return true;
+}
+
+/* Marks CNT reserved sectors starting at SECTOR as used in the
+   free map.  Returns true if successful, false if the free_map
+   file could not be written, in which case the sectors stay
+   reserved. */
+bool
+free_map_claim (block_sector_t sector, size_t cnt)
+{
+  bool success;
+
+  journal_begin ();
+  lock_acquire (&free_map_lock);
+  ASSERT (bitmap_none (free_map, sector, cnt));
+  map_set (sector, cnt, true);
+  success = map_flush ();
+  if (!success)
+    map_set (sector, cnt, false);
+  lock_release (&free_map_lock);
+  journal_end ();
+  return success;
+}
+
+/* Gives CNT reserved but unclaimed sectors starting at SECTOR
+   back to the free extent index. */
+void
+free_map_unreserve (block_sector_t sector, size_t cnt)
+{
+  lock_acquire (&free_map_lock);
+  ASSERT (bitmap_none (free_map, sector, cnt));
+  index_insert (sector, cnt);
+  lock_release (&free_map_lock);
+}
+
+/* Makes CNT sectors starting at SECTOR available for use.
+   Revokes any journaled writes to them, in case they are reused
+   for file data. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  journal_begin ();
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
-  bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  map_set (sector, cnt, false);
+  index_insert (sector, cnt);
+  map_flush ();
+  journal_revoke (sector, cnt);
+  lock_release (&free_map_lock);
+  journal_end ();
 }
 
 /* Opens the free map file and reads it from disk. */
 void
-free_map_open (void) 
+free_map_open (void)
 {
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
+  inode_set_metadata (file_get_inode (free_map_file));
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  lock_acquire (&free_map_lock);
+  index_build ();
+  lock_release (&free_map_lock);
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
-free_map_close (void) 
+free_map_close (void)
 {
   file_close (free_map_file);
 }
@@ -70,7 +277,7 @@ free_map_close (void)
 /* Creates a new free map file on disk and writes the free map to
    it. */
 void
-free_map_create (void) 
+free_map_create (void)
 {
   /* Create inode. */
   if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
@@ -80,6 +287,335 @@ free_map_create (void)
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
+  inode_set_metadata (file_get_inode (free_map_file));
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
+  dirty_lo = 1;
+  dirty_hi = 0;
+}
+
+/* Reports free space fragmentation: stores the number of free
+   sectors into *FREE_CNT, the number of runs of consecutive free
+   sectors into *RUN_CNT, and the length of the longest run into
+   *LARGEST. */
+void
+free_map_fragmentation (size_t *free_cnt, size_t *run_cnt, size_t *largest)
+{
+  struct list_elem *e;
+
+  *free_cnt = *run_cnt = *largest = 0;
+  lock_acquire (&free_map_lock);
+  for (e = list_begin (&extents); e != list_end (&extents);
+       e = list_next (e))
+    {
+      struct free_extent *x = list_entry (e, struct free_extent, addr_elem);
+      ++*run_cnt;
+      *free_cnt += x->cnt;
+      if (x->cnt > *largest)
+        *largest = x->cnt;
+    }
+  lock_release (&free_map_lock);
+}
+
+/* 返回CNT个扇区所属的大小类 */
+static size_t
+size_class (size_t cnt)
+{
+  size_t class = 0;
+
+  ASSERT (cnt > 0);
+  while (cnt > 1 && class < CLASS_CNT - 1)
+    {
+      cnt >>= 1;
+      class++;
+    }
+  return class;
+}
+
+/* 在TABLE中查找以SECTOR为键的区段，没有则返回NULL */
+static struct free_extent *
+extent_lookup (struct hash *table, block_sector_t sector)
+{
+  struct free_extent key;
+  struct hash_elem *e;
+
+  /* cnt为0时start与end相等，同一个key对两张表都适用 */
+  key.start = sector;
+  key.cnt = 0;
+  if (table == &extents_by_start)
+    {
+      e = hash_find (table, &key.start_elem);
+      return e != NULL ? hash_entry (e, struct free_extent, start_elem) : NULL;
+    }
+  else
+    {
+      e = hash_find (table, &key.end_elem);
+      return e != NULL ? hash_entry (e, struct free_extent, end_elem) : NULL;
+    }
+}
+
+/* 把区段E加入大小类链表和两张哈希表，不动地址链表 */
+static void
+extent_link (struct free_extent *e)
+{
+  list_push_front (&size_classes[size_class (e->cnt)], &e->size_elem);
+  hash_insert (&extents_by_start, &e->start_elem);
+  hash_insert (&extents_by_end, &e->end_elem);
+}
+
+/* 从大小类链表和两张哈希表中移除区段E，不动地址链表 */
+static void
+extent_unlink (struct free_extent *e)
+{
+  list_remove (&e->size_elem);
+  hash_delete (&extents_by_start, &e->start_elem);
+  hash_delete (&extents_by_end, &e->end_elem);
+}
+
+/* 把区段E改为从START开始的CNT个扇区，CNT为0时释放E。
+   新的范围不能越过E在地址链表中的前后邻居 */
+static void
+extent_resize (struct free_extent *e, block_sector_t start, size_t cnt)
+{
+  extent_unlink (e);
+  if (cnt == 0)
+    {
+      list_remove (&e->addr_elem);
+      kmem_cache_free (extent_cache, e);
+      return;
+    }
+  e->start = start;
+  e->cnt = cnt;
+  extent_link (e);
+}
+
+/* 新建一个从START开始的CNT个扇区的区段，插到地址链表中BEFORE之前。
+   内存不足时返回false，这些扇区在位图中仍是空闲的，但直到下次
+   挂载重建索引前都不会被分配 */
+static bool
+extent_create (block_sector_t start, size_t cnt, struct list_elem *before)
+{
+  struct free_extent *e = kmem_cache_alloc (extent_cache);
+  if (e == NULL)
+    return false;
+  e->start = start;
+  e->cnt = cnt;
+  list_insert (before, &e->addr_elem);
+  extent_link (e);
+  return true;
+}
+
+/* 丢弃整个索引，再扫描一遍位图重建 */
+static void
+index_build (void)
+{
+  size_t size = bitmap_size (free_map);
+  size_t i, run = 0;
+
+  hash_clear (&extents_by_start, NULL);
+  hash_clear (&extents_by_end, NULL);
+  while (!list_empty (&extents))
+    {
+      struct list_elem *e = list_pop_front (&extents);
+      struct free_extent *x = list_entry (e, struct free_extent, addr_elem);
+      list_remove (&x->size_elem);
+      kmem_cache_free (extent_cache, x);
+    }
+
+  for (i = 0; i <= size; i++)
+    if (i < size && !bitmap_test (free_map, i))
+      run++;
+    else if (run > 0)
+      {
+        extent_create (i - run, run, list_end (&extents));
+        run = 0;
+      }
+  next_fit = 0;
+}
+
+/* 把刚释放的从SECTOR开始的CNT个扇区加入索引，并与两侧相邻的
+   空闲区段合并 */
+static void
+index_insert (block_sector_t sector, size_t cnt)
+{
+  struct free_extent *left = extent_lookup (&extents_by_end, sector);
+  struct free_extent *right = extent_lookup (&extents_by_start, sector + cnt);
+  struct list_elem *e;
+
+  if (left != NULL && right != NULL)
+    {
+      size_t total = left->cnt + cnt + right->cnt;
+      extent_resize (right, right->start, 0);
+      extent_resize (left, left->start, total);
+    }
+  else if (left != NULL)
+    extent_resize (left, left->start, left->cnt + cnt);
+  else if (right != NULL)
+    extent_resize (right, sector, cnt + right->cnt);
+  else
+    {
+      /* 两侧都不空闲，只能沿地址链表找插入位置 */
+      for (e = list_begin (&extents); e != list_end (&extents);
+           e = list_next (e))
+        if (list_entry (e, struct free_extent, addr_elem)->start > sector)
+          break;
+      extent_create (sector, cnt, e);
+    }
+}
+
+/* 从区段E中取出从SECTOR开始的CNT个扇区，它们必须都在E中。
+   从中间取需要把E拆成两段，内存不足时返回false且不做任何改变 */
+static bool
+index_take (struct free_extent *e, block_sector_t sector, size_t cnt)
+{
+  block_sector_t end = e->start + e->cnt;
+
+  ASSERT (sector >= e->start && sector + cnt <= end);
+
+  if (sector == e->start)
+    extent_resize (e, sector + cnt, e->cnt - cnt);
+  else if (sector + cnt == end)
+    extent_resize (e, e->start, e->cnt - cnt);
+  else
+    {
+      /* 先缩短E，否则新区段与E的末扇区相同，无法加入哈希表 */
+      extent_resize (e, e->start, sector - e->start);
+      if (!extent_create (sector + cnt, end - (sector + cnt),
+                          list_next (&e->addr_elem)))
+        {
+          extent_resize (e, e->start, end - e->start);
+          return false;
+        }
+    }
+  return true;
+}
+
+/* 返回能容纳CNT个扇区的空闲区段，没有则返回NULL。
+   优先接着上次分配的区段，其次找能容纳的最小大小类 */
+static struct free_extent *
+find_fit (size_t cnt)
+{
+  struct free_extent *e = extent_lookup (&extents_by_start, next_fit);
+  size_t class;
+
+  if (e != NULL && e->cnt >= cnt)
+    return e;
+
+  /* 只有第一个大小类里可能有放不下的区段，更大的类里第一个就行 */
+  for (class = size_class (cnt); class < CLASS_CNT; class++)
+    {
+      struct list_elem *x;
+      for (x = list_begin (&size_classes[class]);
+           x != list_end (&size_classes[class]); x = list_next (x))
+        {
+          e = list_entry (x, struct free_extent, size_elem);
+          if (e->cnt >= cnt)
+            return e;
+        }
+    }
+  return NULL;
+}
+
+/* 返回包含GOAL或在GOAL之后的第一个空闲区段，都没有则返回地址最低的
+   空闲区段，磁盘已满时返回NULL */
+static struct free_extent *
+find_near (block_sector_t goal)
+{
+  struct free_extent *e = extent_lookup (&extents_by_start, goal);
+  struct list_elem *x;
+
+  if (e != NULL)
+    return e;
+  if (list_empty (&extents))
+    return NULL;
+  for (x = list_begin (&extents); x != list_end (&extents); x = list_next (x))
+    {
+      e = list_entry (x, struct free_extent, addr_elem);
+      if (e->start + e->cnt > goal)
+        return e;
+    }
+  return list_entry (list_front (&extents), struct free_extent, addr_elem);
+}
+
+/* 把位图中从SECTOR开始的CNT位设为VALUE，并记下空闲位图文件中
+   需要写回的扇区 */
+static void
+map_set (block_sector_t sector, size_t cnt, bool value)
+{
+  size_t lo = sector / BITS_PER_SECTOR;
+  size_t hi = (sector + cnt - 1) / BITS_PER_SECTOR;
+
+  bitmap_set_multiple (free_map, sector, cnt, value);
+  if (dirty_lo > dirty_hi)
+    {
+      dirty_lo = lo;
+      dirty_hi = hi;
+    }
+  else
+    {
+      if (lo < dirty_lo)
+        dirty_lo = lo;
+      if (hi > dirty_hi)
+        dirty_hi = hi;
+    }
+}
+
+/* 只把空闲位图文件中被修改过的扇区写回。空闲位图文件还不存在时
+   (格式化期间)什么也不做，free_map_create()会写入整个位图 */
+static bool
+map_flush (void)
+{
+  size_t size = bitmap_size (free_map);
+  size_t start, end;
+
+  if (free_map_file == NULL || dirty_lo > dirty_hi)
+    return true;
+  start = dirty_lo * BITS_PER_SECTOR;
+  end = (dirty_hi + 1) * BITS_PER_SECTOR;
+  if (end > size)
+    end = size;
+  if (!bitmap_write_range (free_map, free_map_file, start, end - start))
+    return false;
+  dirty_lo = 1;
+  dirty_hi = 0;
+  return true;
+}
+
+/* 以区段首扇区为键的哈希函数 */
+static unsigned
+start_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct free_extent, start_elem)->start);
+}
+
+/* 按区段首扇区比较 */
+static bool
+start_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct free_extent, start_elem)->start
+          < hash_entry (b, struct free_extent, start_elem)->start);
+}
+
+/* 返回区段E末扇区的下一个扇区 */
+static block_sector_t
+extent_end (const struct hash_elem *e)
+{
+  const struct free_extent *x = hash_entry (e, struct free_extent, end_elem);
+  return x->start + x->cnt;
+}
+
+/* 以区段末扇区的下一个扇区为键的哈希函数 */
+static unsigned
+end_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (extent_end (e));
+}
+
+/* 按区段末扇区的下一个扇区比较 */
+static bool
+end_less (const struct hash_elem *a, const struct hash_elem *b,
+          void *aux UNUSED)
+{
+  return extent_end (a) < extent_end (b);
 }
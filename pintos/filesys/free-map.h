@@ -12,6 +12,12 @@ void free_map_open (void);
 void free_map_close (void);
 
 bool free_map_allocate (size_t, block_sector_t *);
+bool free_map_reserve (block_sector_t goal, size_t max_cnt,
+                       block_sector_t *, size_t *);
+bool free_map_claim (block_sector_t, size_t);
+void free_map_unreserve (block_sector_t, size_t);
 void free_map_release (block_sector_t, size_t);
+void free_map_fragmentation (size_t *free_cnt, size_t *run_cnt,
+                             size_t *largest);
 
 #endif /* filesys/free-map.h */
@@ -4,11 +4,18 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ustar.h>
+#include "devices/ide.h"
+#include "devices/timer.h"
+#include "filesys/cache.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "filesys/inode.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
 
 /* List files in the root directory. */
@@ -220,3 +227,308 @@ fsutil_append (char **argv)
   file_close (src);
   free (buffer);
 }
+
+/* Prints how many extents (runs of consecutive sectors) each file
+   in the root directory occupies, and how fragmented the free
+   space is. */
+void
+fsutil_frag (char **argv UNUSED)
+{
+  struct dir *dir;
+  char name[NAME_MAX + 1];
+  size_t free_cnt, run_cnt, largest;
+
+  printf ("Fragmentation of files in the root directory:\n");
+  dir = dir_open_root ();
+  if (dir == NULL)
+    PANIC ("root dir open failed");
+  while (dir_readdir (dir, name))
+    {
+      struct file *file = filesys_open (name);
+      if (file == NULL)
+        PANIC ("%s: open failed", name);
+      printf ("%-14s %8"PROTd" bytes in %zu extents\n", name,
+              file_length (file), inode_extent_cnt (file_get_inode (file)));
+      file_close (file);
+    }
+  dir_close (dir);
+
+  free_map_fragmentation (&free_cnt, &run_cnt, &largest);
+  printf ("Free space: %zu sectors in %zu runs, largest run %zu sectors.\n",
+          free_cnt, run_cnt, largest);
+}
+
+/* Measures sequential throughput: writes a new ARGV[1]-kB file
+   one page at a time, flushes the buffer cache, reads the file
+   back, and reports the time taken by each step.  The file is
+   deleted afterward. */
+void
+fsutil_seqbench (char **argv)
+{
+  static const char *file_name = "seqbench.tmp";
+  off_t size = atoi (argv[1]) * 1024;
+  struct file *file;
+  uint8_t *buffer;
+  int64_t start, write_ticks, read_ticks;
+  size_t extent_cnt;
+  off_t ofs;
+
+  printf ("Sequential throughput with a %"PROTd" kB file...\n", size / 1024);
+  if (size <= 0)
+    PANIC ("seqbench: bad size '%s'", argv[1]);
+
+  buffer = palloc_get_page (PAL_ASSERT);
+  for (ofs = 0; ofs < PGSIZE; ofs++)
+    buffer[ofs] = ofs;
+
+  if (!filesys_create (file_name, 0))
+    PANIC ("%s: create failed", file_name);
+  file = filesys_open (file_name);
+  if (file == NULL)
+    PANIC ("%s: open failed", file_name);
+  start = timer_ticks ();
+  for (ofs = 0; ofs < size; ofs += PGSIZE)
+    {
+      off_t chunk_size = size - ofs < PGSIZE ? size - ofs : PGSIZE;
+      if (file_write (file, buffer, chunk_size) != chunk_size)
+        PANIC ("%s: write failed at offset %"PROTd, file_name, ofs);
+    }
+  cache_flush ();
+  write_ticks = timer_elapsed (start);
+  extent_cnt = inode_extent_cnt (file_get_inode (file));
+  file_close (file);
+
+  file = filesys_open (file_name);
+  if (file == NULL)
+    PANIC ("%s: open failed", file_name);
+  start = timer_ticks ();
+  while (file_read (file, buffer, PGSIZE) > 0)
+    continue;
+  read_ticks = timer_elapsed (start);
+  file_close (file);
+
+  if (!filesys_remove (file_name))
+    PANIC ("%s: delete failed", file_name);
+  palloc_free_page (buffer);
+
+  printf ("Wrote %"PROTd" kB in %zu extents in %lld ticks (%lld kB/s).\n",
+          size / 1024, extent_cnt, write_ticks,
+          size / 1024 * TIMER_FREQ / (write_ticks > 0 ? write_ticks : 1));
+  printf ("Read %"PROTd" kB in %lld ticks (%lld kB/s).\n",
+          size / 1024, read_ticks,
+          size / 1024 * TIMER_FREQ / (read_ticks > 0 ? read_ticks : 1));
+}
+
+/* Measures operations on a large directory: creates ARGV[1]
+   empty files in the root directory, opens each of them, deletes
+   them again, and reports the time taken by each step. */
+void
+fsutil_dirbench (char **argv)
+{
+  int cnt = atoi (argv[1]);
+  int64_t start, create_ticks, open_ticks, remove_ticks;
+  char name[NAME_MAX + 1];
+  int i;
+
+  printf ("Directory operations with %d files...\n", cnt);
+  if (cnt <= 0)
+    PANIC ("dirbench: bad count '%s'", argv[1]);
+
+  start = timer_ticks ();
+  for (i = 0; i < cnt; i++)
+    {
+      snprintf (name, sizeof name, "db%d", i);
+      if (!filesys_create (name, 0))
+        PANIC ("%s: create failed", name);
+    }
+  create_ticks = timer_elapsed (start);
+
+  start = timer_ticks ();
+  for (i = 0; i < cnt; i++)
+    {
+      struct file *file;
+      snprintf (name, sizeof name, "db%d", i);
+      file = filesys_open (name);
+      if (file == NULL)
+        PANIC ("%s: open failed", name);
+      file_close (file);
+    }
+  open_ticks = timer_elapsed (start);
+
+  start = timer_ticks ();
+  for (i = 0; i < cnt; i++)
+    {
+      snprintf (name, sizeof name, "db%d", i);
+      if (!filesys_remove (name))
+        PANIC ("%s: delete failed", name);
+    }
+  remove_ticks = timer_elapsed (start);
+
+  printf ("Created %d files in %lld ticks.\n", cnt, create_ticks);
+  printf ("Opened %d files in %lld ticks.\n", cnt, open_ticks);
+  printf ("Deleted %d files in %lld ticks.\n", cnt, remove_ticks);
+}
+
+/* Number of threads and rounds used by fsutil_inodestress(). */
+#define INODESTRESS_THREADS 4
+#define INODESTRESS_ROUNDS 4
+
+/* Number of inodes each fsutil_inodestress() thread keeps open
+   at once. */
+#define INODESTRESS_WINDOW 16
+
+/* State shared by the threads of fsutil_inodestress(). */
+struct inodestress
+  {
+    block_sector_t *sectors;            /* Sectors of the inodes. */
+    int cnt;                            /* Number of inodes. */
+    struct semaphore done;              /* Upped by each thread at exit. */
+  };
+
+/* Opens and closes the inodes in the shared state IS_, stepping
+   through them INODESTRESS_ROUNDS times with a stride that
+   differs from thread to thread, and keeps the last
+   INODESTRESS_WINDOW of them open. */
+static void
+inodestress_thread (void *is_)
+{
+  struct inodestress *is = is_;
+  struct inode *window[INODESTRESS_WINDOW];
+  int stride = 1 + 2 * (thread_current ()->tid % INODESTRESS_THREADS);
+  int round, i, w = 0;
+
+  memset (window, 0, sizeof window);
+  for (round = 0; round < INODESTRESS_ROUNDS; round++)
+    for (i = 0; i < is->cnt; i++)
+      {
+        block_sector_t sector = is->sectors[(i * stride + round) % is->cnt];
+        struct inode *inode = inode_open (sector);
+        struct inode *again = inode_open (sector);
+
+        if (inode == NULL || inode != again
+            || inode_get_inumber (inode) != sector)
+          PANIC ("inodestress: bad open of sector %"PRDSNu, sector);
+        inode_close (again);
+        inode_close (window[w]);
+        window[w] = inode;
+        w = (w + 1) % INODESTRESS_WINDOW;
+      }
+  for (w = 0; w < INODESTRESS_WINDOW; w++)
+    inode_close (window[w]);
+  sema_up (&is->done);
+}
+
+/* Stresses the open inode table: creates ARGV[1] empty inodes,
+   opens and closes each of them many times from several threads
+   at once, and reports the time taken.  The inodes are deleted
+   afterward. */
+void
+fsutil_inodestress (char **argv)
+{
+  struct inodestress is;
+  int64_t start, ticks;
+  int i;
+
+  is.cnt = atoi (argv[1]);
+  printf ("Open inode stress with %d inodes...\n", is.cnt);
+  if (is.cnt <= 0)
+    PANIC ("inodestress: bad count '%s'", argv[1]);
+
+  is.sectors = malloc (is.cnt * sizeof *is.sectors);
+  if (is.sectors == NULL)
+    PANIC ("inodestress: out of memory");
+  for (i = 0; i < is.cnt; i++)
+    if (!free_map_allocate (1, &is.sectors[i])
+        || !inode_create (is.sectors[i], 0))
+      PANIC ("inodestress: inode %d: create failed", i);
+  sema_init (&is.done, 0);
+
+  start = timer_ticks ();
+  for (i = 0; i < INODESTRESS_THREADS; i++)
+    if (thread_create ("inodestress", PRI_DEFAULT,
+                       inodestress_thread, &is) == TID_ERROR)
+      PANIC ("inodestress: thread_create failed");
+  for (i = 0; i < INODESTRESS_THREADS; i++)
+    sema_down (&is.done);
+  ticks = timer_elapsed (start);
+
+  for (i = 0; i < is.cnt; i++)
+    {
+      struct inode *inode = inode_open (is.sectors[i]);
+      if (inode == NULL)
+        PANIC ("inodestress: inode %d: open failed", i);
+      inode_remove (inode);
+      inode_close (inode);
+    }
+  free (is.sectors);
+
+  printf ("%d threads made %d opens of %d inodes in %lld ticks.\n",
+          INODESTRESS_THREADS,
+          INODESTRESS_THREADS * INODESTRESS_ROUNDS * 2 * is.cnt, is.cnt, ticks);
+}
+
+/* Reads a file of ARGV[1] kB with bus-master DMA and then in PIO
+   mode, and reports for each how many timer ticks it took and
+   how many of them the CPU spent idle, free to run other
+   threads. */
+void
+fsutil_dmabench (char **argv)
+{
+  static const char *file_name = "dmabench.tmp";
+  off_t size = atoi (argv[1]) * 1024;
+  struct file *file;
+  uint8_t *buffer;
+  off_t ofs;
+  int pass;
+
+  printf ("Reading a %"PROTd" kB file with DMA and with PIO...\n",
+          size / 1024);
+  if (size <= 0)
+    PANIC ("dmabench: bad size '%s'", argv[1]);
+  if (!ide_has_dma ())
+    printf ("No disk supports bus-master DMA; both passes use PIO.\n");
+
+  buffer = palloc_get_page (PAL_ASSERT);
+  for (ofs = 0; ofs < PGSIZE; ofs++)
+    buffer[ofs] = ofs;
+
+  if (!filesys_create (file_name, 0))
+    PANIC ("%s: create failed", file_name);
+  file = filesys_open (file_name);
+  if (file == NULL)
+    PANIC ("%s: open failed", file_name);
+  for (ofs = 0; ofs < size; ofs += PGSIZE)
+    {
+      off_t chunk_size = size - ofs < PGSIZE ? size - ofs : PGSIZE;
+      if (file_write (file, buffer, chunk_size) != chunk_size)
+        PANIC ("%s: write failed at offset %"PROTd, file_name, ofs);
+    }
+  cache_flush ();
+
+  /* The file is much bigger than the cache, so each pass reads
+     nearly all of it from disk. */
+  for (pass = 0; pass < 2; pass++)
+    {
+      bool dma = pass == 0;
+      int64_t start, ticks;
+      long long idle;
+
+      ide_set_dma (dma);
+      file_seek (file, 0);
+      start = timer_ticks ();
+      idle = thread_idle_ticks ();
+      while (file_read (file, buffer, PGSIZE) > 0)
+        continue;
+      ticks = timer_elapsed (start);
+      idle = thread_idle_ticks () - idle;
+      printf ("%s: read %"PROTd" kB in %lld ticks, %lld of them idle "
+              "(%lld%%).\n", dma ? "DMA" : "PIO", size / 1024, ticks, idle,
+              idle * 100 / (ticks > 0 ? ticks : 1));
+    }
+  ide_set_dma (true);
+
+  file_close (file);
+  if (!filesys_remove (file_name))
+    PANIC ("%s: delete failed", file_name);
+  palloc_free_page (buffer);
+}
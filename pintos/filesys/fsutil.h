@@ -6,5 +6,10 @@ void fsutil_cat (char **argv);
 void fsutil_rm (char **argv);
 void fsutil_extract (char **argv);
 void fsutil_append (char **argv);
+void fsutil_frag (char **argv);
+void fsutil_seqbench (char **argv);
+void fsutil_dirbench (char **argv);
+void fsutil_inodestress (char **argv);
+void fsutil_dmabench (char **argv);
 
 #endif /* filesys/fsutil.h */
@@ -1,23 +1,47 @@
 #include "filesys/inode.h"
-#include <list.h>
 #include <debug.h>
+#include <hash.h>
 #include <round.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Number of direct sector pointers in an inode, and of sector
+   pointers in an indirect block. */
+#define DIRECT_CNT 124
+#define INDIRECT_CNT (BLOCK_SECTOR_SIZE / sizeof (block_sector_t))
+
+/* Maximum file size, in sectors. */
+#define MAX_SECTORS (DIRECT_CNT + INDIRECT_CNT + INDIRECT_CNT * INDIRECT_CNT)
+
+/* Sector pointer of a data or index block that has not been
+   allocated.  Sector 0 holds the free map's inode, so it is never
+   used for file data.  Reading a hole yields zeros. */
+#define NO_SECTOR 0
+
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+
+   The first DIRECT_CNT sectors of the file are found through
+   DIRECT, the next INDIRECT_CNT through the indirect block, and
+   the rest through the doubly indirect block, which points to
+   indirect blocks.  Sectors are allocated when they are first
+   written, so a file may have holes. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
+    block_sector_t direct[DIRECT_CNT];  /* Direct data sectors. */
+    block_sector_t indirect;            /* Indirect block. */
+    block_sector_t doubly_indirect;     /* Doubly indirect block. */
   };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -28,40 +52,245 @@ bytes_to_sectors (off_t size)
   return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
 }
 
+/* Sectors reserved for a file's data, so that data sectors
+   allocated one at a time as the file grows still end up next to
+   each other on disk.  A reservation lives only in memory: its
+   sectors are marked used in the free map one at a time as they
+   are taken, and unused ones are given back when the inode is
+   closed.  Index blocks are never taken from a reservation. */
+struct reservation
+  {
+    block_sector_t start;               /* 第一个预留的扇区 */
+    size_t cnt;                         /* 预留的扇区数 */
+    block_sector_t goal;                /* 下次预留时希望开始的扇区 */
+    size_t want;                        /* 下次预留的扇区数 */
+  };
+
+/* Number of sectors reserved at a time for a growing file. */
+#define RESERVE_SECTORS 32
+
 /* In-memory inode. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in open_inodes. */
     block_sector_t sector;              /* Sector number of disk location. */
-    int open_cnt;                       /* Number of openers. */
+    int open_cnt;                       /* 打开者数，受open_inodes_lock保护 */
     bool removed;                       /* True if deleted, false otherwise. */
+    bool metadata;                      /* 内容是否是元数据，需要写日志 */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    struct lock lock;                   /* 分配扇区和修改长度时持有 */
+    struct reservation rsv;             /* 为增长预留的扇区，受lock保护 */
     struct inode_disk data;             /* Inode content. */
   };
 
+/* 初始化RSV，下次预留时从GOAL附近预留WANT个扇区。 */
+static void
+reservation_init (struct reservation *rsv, block_sector_t goal, size_t want)
+{
+  rsv->start = NO_SECTOR;
+  rsv->cnt = 0;
+  rsv->goal = goal;
+  rsv->want = want > 0 ? want : 1;
+}
+
+/* 把RSV中没有用掉的扇区还给空闲表。 */
+static void
+reservation_release (struct reservation *rsv)
+{
+  if (rsv->cnt > 0)
+    free_map_unreserve (rsv->start, rsv->cnt);
+  rsv->cnt = 0;
+}
+
+/* 分配一个扇区并清零，把扇区号存入*SECTORP。RSV非空时从RSV中
+   分配数据扇区，RSV用完时尽量在上次分配的扇区之后重新预留；
+   RSV为空时分配索引块，索引块的清零写入日志。 */
+static bool
+allocate_zeroed (struct reservation *rsv, block_sector_t *sectorp)
+{
+  static char zeros[BLOCK_SECTOR_SIZE];
+
+  if (rsv == NULL)
+    {
+      if (!free_map_allocate (1, sectorp))
+        return false;
+    }
+  else
+    {
+      if (rsv->cnt == 0
+          && !free_map_reserve (rsv->goal, rsv->want,
+                                &rsv->start, &rsv->cnt))
+        return false;
+      if (!free_map_claim (rsv->start, 1))
+        return false;
+      *sectorp = rsv->start++;
+      rsv->cnt--;
+      rsv->goal = *sectorp + 1;
+    }
+  if (rsv == NULL)
+    journal_write (*sectorp, zeros, 0, BLOCK_SECTOR_SIZE);
+  else
+    cache_write (*sectorp, zeros, 0, BLOCK_SECTOR_SIZE);
+  return true;
+}
+
+/* 返回*SLOT中的扇区号。扇区尚未分配且CREATE为真时用
+   allocate_zeroed (RSV, ...)分配一个清零的扇区存入*SLOT，并把
+   *CHANGED设为真。没有分配时返回NO_SECTOR。 */
+static block_sector_t
+get_slot (block_sector_t *slot, bool create, struct reservation *rsv,
+          bool *changed)
+{
+  if (*slot == NO_SECTOR && create && allocate_zeroed (rsv, slot))
+    *changed = true;
+  return *slot;
+}
+
+/* 返回索引块BLOCK中第IDX个扇区号，其余参数同get_slot()。 */
+static block_sector_t
+get_index (block_sector_t block, size_t idx, bool create,
+           struct reservation *rsv)
+{
+  block_sector_t sector;
+  bool changed = false;
+
+  ASSERT (idx < INDIRECT_CNT);
+
+  cache_read (block, &sector, idx * sizeof sector, sizeof sector);
+  get_slot (&sector, create, rsv, &changed);
+  if (changed)
+    journal_write (block, &sector, idx * sizeof sector, sizeof sector);
+  return sector;
+}
+
 /* Returns the block device sector that contains byte offset POS
-   within INODE.
-   Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+   within the file whose on-disk inode is DISK.  If RSV is
+   non-null and that sector has not been allocated, allocates it
+   from RSV (and any index blocks needed to reach it from the free
+   map), setting *CHANGED to true if DISK itself was modified.
+   Returns NO_SECTOR if the sector is not allocated, or if RSV is
+   non-null and allocation fails or POS is beyond the maximum file
+   size. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+disk_byte_to_sector (struct inode_disk *disk, off_t pos,
+                     struct reservation *rsv, bool *changed)
 {
+  size_t idx = pos / BLOCK_SECTOR_SIZE;
+  bool create = rsv != NULL;
+  block_sector_t block;
+
+  if (idx < DIRECT_CNT)
+    return get_slot (&disk->direct[idx], create, rsv, changed);
+  idx -= DIRECT_CNT;
+
+  if (idx < INDIRECT_CNT)
+    {
+      block = get_slot (&disk->indirect, create, NULL, changed);
+      return (block != NO_SECTOR
+              ? get_index (block, idx, create, rsv) : NO_SECTOR);
+    }
+  idx -= INDIRECT_CNT;
+
+  if (idx < INDIRECT_CNT * INDIRECT_CNT)
+    {
+      block = get_slot (&disk->doubly_indirect, create, NULL, changed);
+      if (block != NO_SECTOR)
+        block = get_index (block, idx / INDIRECT_CNT, create, NULL);
+      return (block != NO_SECTOR
+              ? get_index (block, idx % INDIRECT_CNT, create, rsv)
+              : NO_SECTOR);
+    }
+  return NO_SECTOR;
+}
+
+/* Returns the block device sector that contains byte offset POS
+   within INODE, or NO_SECTOR if POS falls in a hole. */
+static block_sector_t
+byte_to_sector (struct inode *inode, off_t pos) 
+{
+  bool changed = false;
+
   ASSERT (inode != NULL);
-  if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
-  else
-    return -1;
+  return disk_byte_to_sector (&inode->data, pos, NULL, &changed);
+}
+
+/* Like byte_to_sector(), but allocates the sector if it is in a
+   hole.  Returns NO_SECTOR if allocation fails. */
+static block_sector_t
+byte_to_sector_create (struct inode *inode, off_t pos)
+{
+  block_sector_t sector;
+  bool changed = false;
+
+  journal_begin ();
+  lock_acquire (&inode->lock);
+  sector = disk_byte_to_sector (&inode->data, pos, &inode->rsv, &changed);
+  if (changed)
+    journal_write (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+  lock_release (&inode->lock);
+  journal_end ();
+  return sector;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* 释放索引块BLOCK以及它指向的所有扇区。LEVEL为1时BLOCK指向数据
+   扇区，为2时指向间接块。 */
+static void
+free_index (block_sector_t block, int level)
+{
+  size_t i;
+
+  for (i = 0; i < INDIRECT_CNT; i++)
+    {
+      block_sector_t sector;
+
+      cache_read (block, &sector, i * sizeof sector, sizeof sector);
+      if (sector == NO_SECTOR)
+        continue;
+      if (level > 1)
+        free_index (sector, level - 1);
+      else
+        free_map_release (sector, 1);
+    }
+  free_map_release (block, 1);
+}
+
+/* 释放DISK的所有数据扇区和索引块。 */
+static void
+free_disk (struct inode_disk *disk)
+{
+  size_t i;
+
+  for (i = 0; i < DIRECT_CNT; i++)
+    if (disk->direct[i] != NO_SECTOR)
+      free_map_release (disk->direct[i], 1);
+  if (disk->indirect != NO_SECTOR)
+    free_index (disk->indirect, 1);
+  if (disk->doubly_indirect != NO_SECTOR)
+    free_index (disk->doubly_indirect, 2);
+}
+
+/* Open inodes, keyed by sector, so that opening a single inode
+   twice returns the same `struct inode'. */
+static struct hash open_inodes;
+static struct lock open_inodes_lock;    /* 保护open_inodes和open_cnt */
+
+static hash_hash_func inode_hash;
+static hash_less_func inode_less;
+
+/* Cache of `struct inode's. */
+static struct kmem_cache *inode_cache;
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  if (!hash_init (&open_inodes, inode_hash, inode_less, NULL))
+    PANIC ("open inode table creation failed");
+  lock_init (&open_inodes_lock);
+  lock_set_name (&open_inodes_lock, "open inodes");
+  inode_cache = kmem_cache_create ("inode", sizeof (struct inode), NULL);
+  if (inode_cache == NULL)
+    PANIC ("inode cache creation failed");
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -85,59 +314,100 @@ inode_create (block_sector_t sector, off_t length)
   if (disk_inode != NULL)
     {
       size_t sectors = bytes_to_sectors (length);
+      struct reservation rsv;
+      size_t i;
+      bool changed;
+
       disk_inode->length = length;
       disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start)) 
-        {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0) 
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
-          success = true; 
-        } 
+
+      /* Allocate the initial data sectors now, zeroed, so that
+         creating a file fails if the disk is full.  Later growth
+         allocates sectors as they are written.  Reserve them all
+         at once, near the inode, so they are contiguous if
+         possible. */
+      journal_begin ();
+      reservation_init (&rsv, sector + 1, sectors);
+      success = sectors <= MAX_SECTORS;
+      for (i = 0; success && i < sectors; i++)
+        success = disk_byte_to_sector (disk_inode, i * BLOCK_SECTOR_SIZE,
+                                       &rsv, &changed) != NO_SECTOR;
+      reservation_release (&rsv);
+      if (success)
+        journal_write (sector, disk_inode, 0, BLOCK_SECTOR_SIZE);
+      else
+        free_disk (disk_inode);
+      journal_end ();
       free (disk_inode);
     }
   return success;
 }
 
+/* 返回扇区SECTOR中已打开的inode并增加其打开计数，
+   没有则返回NULL。必须持有open_inodes_lock */
+static struct inode *
+find_open_inode (block_sector_t sector)
+{
+  struct inode key;
+  struct hash_elem *e;
+
+  key.sector = sector;
+  e = hash_find (&open_inodes, &key.elem);
+  if (e == NULL)
+    return NULL;
+  hash_entry (e, struct inode, elem)->open_cnt++;
+  return hash_entry (e, struct inode, elem);
+}
+
 /* Reads an inode from SECTOR
    and returns a `struct inode' that contains it.
    Returns a null pointer if memory allocation fails. */
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
-  struct inode *inode;
+  struct inode *inode, *open;
+  block_sector_t goal;
 
   /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
-    {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
-        {
-          inode_reopen (inode);
-          return inode; 
-        }
-    }
+  lock_acquire (&open_inodes_lock);
+  inode = find_open_inode (sector);
+  lock_release (&open_inodes_lock);
+  if (inode != NULL)
+    return inode;
 
   /* Allocate memory. */
-  inode = malloc (sizeof *inode);
+  inode = kmem_cache_alloc (inode_cache);
   if (inode == NULL)
     return NULL;
 
-  /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
+  /* Initialize, without holding the lock while reading the
+     disk. */
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  inode->metadata = false;
+  lock_init (&inode->lock);
+  cache_read (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+
+  /* Future growth should continue right after the file's last
+     data sector. */
+  goal = inode->data.length > 0
+         ? byte_to_sector (inode, inode->data.length - 1) : NO_SECTOR;
+  reservation_init (&inode->rsv, (goal != NO_SECTOR ? goal : sector) + 1,
+                    RESERVE_SECTORS);
+
+  /* Another thread may have opened the same inode meanwhile. */
+  lock_acquire (&open_inodes_lock);
+  open = find_open_inode (sector);
+  if (open == NULL)
+    hash_insert (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
+  if (open != NULL)
+    {
+      kmem_cache_free (inode_cache, inode);
+      return open;
+    }
   return inode;
 }
 
@@ -146,7 +416,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -163,25 +437,32 @@ inode_get_inumber (const struct inode *inode)
 void
 inode_close (struct inode *inode) 
 {
+  bool last;
+
   /* Ignore null pointer. */
   if (inode == NULL)
     return;
 
   /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  lock_acquire (&open_inodes_lock);
+  last = --inode->open_cnt == 0;
+  if (last)
+    hash_delete (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
+  if (last)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
+      journal_begin ();
+      reservation_release (&inode->rsv);
  
       /* Deallocate blocks if removed. */
       if (inode->removed) 
         {
           free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
+          free_disk (&inode->data);
         }
+      journal_end ();
 
-      free (inode); 
+      kmem_cache_free (inode_cache, inode);
     }
 }
 
@@ -194,6 +475,45 @@ inode_remove (struct inode *inode)
   inode->removed = true;
 }
 
+/* Marks INODE as holding file system metadata, such as a
+   directory or the free map, so that writes to its data are
+   journaled like writes to the inode itself. */
+void
+inode_set_metadata (struct inode *inode)
+{
+  ASSERT (inode != NULL);
+  inode->metadata = true;
+}
+
+/* 把INODE中从OFFSET开始的SIZE个字节所在的扇区读入缓存，磁盘上
+   连续的扇区一次读入。 */
+static void
+prefetch (struct inode *inode, off_t offset, off_t size)
+{
+  block_sector_t start = NO_SECTOR;
+  size_t cnt = 0;
+  off_t end = offset + size;
+
+  if (end > inode_length (inode))
+    end = inode_length (inode);
+  for (offset = ROUND_DOWN (offset, BLOCK_SECTOR_SIZE); offset < end;
+       offset += BLOCK_SECTOR_SIZE)
+    {
+      block_sector_t sector = byte_to_sector (inode, offset);
+      if (cnt > 0 && sector == start + cnt)
+        cnt++;
+      else
+        {
+          if (cnt > 0)
+            cache_prefetch (start, cnt);
+          start = sector;
+          cnt = sector != NO_SECTOR;
+        }
+    }
+  if (cnt > 0)
+    cache_prefetch (start, cnt);
+}
+
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
    than SIZE if an error occurs or end of file is reached. */
@@ -202,7 +522,12 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
+
+  /* A read of more than one sector, such as the loader's or the
+     free map's, reads consecutive sectors from disk in one
+     request. */
+  if (size > BLOCK_SECTOR_SIZE)
+    prefetch (inode, offset, size);
 
   while (size > 0) 
     {
@@ -220,103 +545,132 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
-        }
-      else 
-        {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-        }
+      /* Copy the chunk out of the buffer cache, or zeros if it
+         lies in a hole. */
+      if (sector_idx != NO_SECTOR)
+        cache_read (sector_idx, buffer + bytes_read, sector_ofs, chunk_size);
+      else
+        memset (buffer + bytes_read, 0, chunk_size);
       
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
 
   return bytes_read;
 }
 
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if the disk is full, the maximum file size is
+   reached, or an error occurs.
+   Writing past end of file extends the inode.  Sectors between
+   the old end of file and OFFSET are left unallocated.
+   Writes to a metadata inode are journaled as one operation. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset) 
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
 
   if (inode->deny_write_cnt)
     return 0;
 
+  if (inode->metadata)
+    journal_begin ();
+
   while (size > 0) 
     {
       /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx;
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
-      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
-
       /* Number of bytes to actually write into this sector. */
-      int chunk_size = size < min_left ? size : min_left;
-      if (chunk_size <= 0)
+      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
+      int chunk_size = size < sector_left ? size : sector_left;
+
+      /* Allocate the sector if it is past end of file or in a
+         hole. */
+      sector_idx = byte_to_sector (inode, offset);
+      if (sector_idx == NO_SECTOR)
+        sector_idx = byte_to_sector_create (inode, offset);
+      if (sector_idx == NO_SECTOR)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
-        }
-      else 
-        {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
-        }
+      /* Copy the chunk into the buffer cache.  The rest of the
+         sector is read in first unless the chunk covers it. */
+      if (inode->metadata)
+        journal_write (sector_idx, buffer + bytes_written, sector_ofs,
+                       chunk_size);
+      else
+        cache_write (sector_idx, buffer + bytes_written, sector_ofs,
+                     chunk_size);
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
 
+  /* Extend the file if we wrote past its end. */
+  if (offset > inode_length (inode))
+    {
+      journal_begin ();
+      lock_acquire (&inode->lock);
+      if (offset > inode->data.length)
+        {
+          inode->data.length = offset;
+          journal_write (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+        }
+      lock_release (&inode->lock);
+      journal_end ();
+    }
+
+  if (inode->metadata)
+    journal_end ();
   return bytes_written;
 }
 
+/* Asks the buffer cache to read ahead the sectors of INODE that
+   hold the SIZE bytes starting at OFFSET, as far as they lie
+   within the file. */
+void
+inode_read_ahead (struct inode *inode, off_t offset, off_t size)
+{
+  off_t end = offset + size;
+
+  if (end > inode_length (inode))
+    end = inode_length (inode);
+  for (offset = ROUND_DOWN (offset, BLOCK_SECTOR_SIZE); offset < end;
+       offset += BLOCK_SECTOR_SIZE)
+    {
+      block_sector_t sector = byte_to_sector (inode, offset);
+      if (sector != NO_SECTOR)
+        cache_read_ahead (sector);
+    }
+}
+
+/* Returns the number of runs of consecutive sectors, or
+   "extents", that hold INODE's data.  Holes are not counted. */
+size_t
+inode_extent_cnt (struct inode *inode)
+{
+  block_sector_t prev = NO_SECTOR;
+  size_t extent_cnt = 0;
+  off_t ofs;
+
+  for (ofs = 0; ofs < inode_length (inode); ofs += BLOCK_SECTOR_SIZE)
+    {
+      block_sector_t sector = byte_to_sector (inode, ofs);
+      if (sector != NO_SECTOR && (prev == NO_SECTOR || sector != prev + 1))
+        extent_cnt++;
+      prev = sector;
+    }
+  return extent_cnt;
+}
+
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 void
@@ -343,3 +697,19 @@ inode_length (const struct inode *inode)
 {
   return inode->data.length;
 }
+
+/* 以inode所在扇区为键的哈希函数 */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct inode, elem)->sector);
+}
+
+/* 按inode所在扇区比较 */
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct inode, elem)->sector
+          < hash_entry (b, struct inode, elem)->sector);
+}
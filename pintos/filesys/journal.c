@@ -0,0 +1,464 @@
+#include "filesys/journal.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/cache.h"
+#include "filesys/filesys.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Metadata journal.
+
+   Changes to file system metadata (the free map, inodes, index
+   blocks, and directories) are grouped into transactions and
+   written to a journal before they are written in place, so that
+   after a crash the file system can be brought back to the state
+   after the last committed transaction by replaying the journal,
+   without looking at the rest of the disk.  File data is not
+   journaled.
+
+   An operation that changes metadata is bracketed by
+   journal_begin() and journal_end(), which may nest, and makes
+   its changes with journal_write() instead of cache_write().
+   Only one thread at a time is between journal_begin() and
+   journal_end(): journal_lock is held throughout.  To avoid
+   deadlock, a thread must call journal_begin() before taking any
+   other file system lock, unless it is already inside.
+
+   The changes of successive operations accumulate in the
+   running transaction, which is committed when it reaches
+   COMMIT_BATCH sectors, every COMMIT_INTERVAL, and in
+   journal_flush().  A transaction never grows beyond TXN_MAX
+   sectors: if an operation would make it bigger, the changes so
+   far are committed first.  Every operation in this file system
+   allocates before it links and unlinks before it frees, so the
+   state committed in the middle of an operation can at worst
+   leak sectors.
+
+   On disk, the journal is a header sector, which gives the
+   sequence number of the first transaction to replay, followed
+   by a log.  Each transaction in the log is a descriptor block,
+   naming the sectors it changes and the sectors it revokes, the
+   new contents of the changed sectors, and a commit block.  The
+   changed sectors stay in the buffer cache, marked uncommitted,
+   until the commit block is on disk.  Replay stops at the first
+   transaction whose descriptor or commit block is missing or has
+   the wrong sequence number.
+
+   A sector that is freed after its contents were logged is
+   "revoked", so that replay does not overwrite it in case it is
+   reused for file data, which is not journaled.
+
+   When the log cannot hold another full transaction, the start
+   of the next transaction writes every dirty buffer back to its
+   place on disk and empties the log ("checkpoint"). */
+
+/* Magic numbers for the journal's header, descriptor, and commit
+   blocks. */
+#define JOURNAL_MAGIC 0x4c4e524a        /* "JRNL" */
+#define DESC_MAGIC 0x43534544           /* "DESC" */
+#define COMMIT_MAGIC 0x54494d43         /* "CMIT" */
+
+/* Number of sectors in the log, after the header. */
+#define LOG_SECTORS (JOURNAL_SECTORS - 1)
+
+/* Number of sector numbers a descriptor block holds. */
+#define DESC_MAX ((BLOCK_SECTOR_SIZE - 16) / sizeof (block_sector_t))
+
+/* Most sectors a transaction changes.  Must be well under
+   CACHE_SIZE, since uncommitted sectors cannot be evicted. */
+#define TXN_MAX 32
+
+/* A transaction is committed at the end of an operation once it
+   changes this many sectors, or after COMMIT_INTERVAL. */
+#define COMMIT_BATCH 16
+#define COMMIT_INTERVAL (5 * TIMER_FREQ)
+
+/* Journal header, in sector JOURNAL_SECTOR. */
+struct journal_header
+  {
+    uint32_t magic;                     /* JOURNAL_MAGIC. */
+    uint32_t seq;                       /* 第一个要重放的事务的序号 */
+    uint8_t unused[BLOCK_SECTOR_SIZE - 8];
+  };
+
+/* First block of a transaction in the log. */
+struct journal_desc
+  {
+    uint32_t magic;                     /* DESC_MAGIC. */
+    uint32_t seq;                       /* Sequence number. */
+    uint32_t block_cnt;                 /* 修改的扇区数，其内容紧随其后 */
+    uint32_t revoke_cnt;                /* 撤销的扇区数 */
+    block_sector_t sectors[DESC_MAX];   /* 先是修改的扇区，后是撤销的扇区 */
+  };
+
+/* Last block of a transaction in the log. */
+struct journal_commit
+  {
+    uint32_t magic;                     /* COMMIT_MAGIC. */
+    uint32_t seq;                       /* Sequence number. */
+    uint8_t unused[BLOCK_SECTOR_SIZE - 8];
+  };
+
+static struct lock journal_lock;        /* 在journal_begin()和journal_end()之间持有 */
+static int depth;                       /* 持有者嵌套调用journal_begin()的层数 */
+static uint32_t next_seq;               /* 下一个提交的事务的序号 */
+static size_t log_pos;                  /* 日志中下一个空闲的位置 */
+
+/* The running transaction. */
+static block_sector_t txn_blocks[TXN_MAX];   /* 修改的扇区 */
+static size_t txn_block_cnt;
+static block_sector_t txn_revokes[DESC_MAX]; /* 撤销的扇区 */
+static size_t txn_revoke_cnt;
+
+/* Sectors logged since the last checkpoint, which must be revoked
+   if they are freed. */
+static struct bitmap *logged;
+static block_sector_t logged_list[LOG_SECTORS];
+static size_t logged_cnt;
+
+/* Buffers for journal blocks, protected by journal_lock. */
+static struct journal_desc desc;
+static struct journal_commit commit_block;
+static uint32_t buffer[BLOCK_SECTOR_SIZE / sizeof (uint32_t)];
+static uint8_t *log_buffer;             /* 事务的描述块和修改的扇区 */
+
+/* Statistics. */
+static unsigned long long commit_cnt;   /* 提交的事务数 */
+static unsigned long long block_cnt;    /* 写入日志的扇区数 */
+static unsigned long long revoke_cnt;   /* 撤销的扇区数 */
+static unsigned long long checkpoint_cnt; /* 检查点数 */
+
+static thread_func commit_thread;
+static uint32_t replay (uint32_t seq);
+static void write_header (void);
+static void commit (void);
+static void reserve (void);
+
+/* Returns the sector of the journal that holds position POS of
+   the log. */
+static inline block_sector_t
+log_sector (size_t pos)
+{
+  ASSERT (pos < LOG_SECTORS);
+  return JOURNAL_SECTOR + 1 + pos;
+}
+
+/* Initializes the journal.  If FORMAT is true, creates an empty
+   journal; otherwise replays the committed transactions in the
+   existing one.  Must be called before anything else reads or
+   writes the file system. */
+void
+journal_init (bool format)
+{
+  struct journal_header *header = (struct journal_header *) buffer;
+
+  ASSERT (sizeof (struct journal_header) == BLOCK_SECTOR_SIZE);
+  ASSERT (sizeof (struct journal_desc) <= BLOCK_SECTOR_SIZE);
+  ASSERT (sizeof (struct journal_commit) == BLOCK_SECTOR_SIZE);
+
+  lock_init (&journal_lock);
+  lock_set_name (&journal_lock, "journal");
+  if (block_size (fs_device) < JOURNAL_SECTOR + JOURNAL_SECTORS)
+    PANIC ("file system device too small for journal");
+  logged = bitmap_create (block_size (fs_device));
+  log_buffer = malloc ((TXN_MAX + 1) * BLOCK_SECTOR_SIZE);
+  if (logged == NULL || log_buffer == NULL)
+    PANIC ("journal initialization failed");
+
+  block_read (fs_device, JOURNAL_SECTOR, header);
+  if (format)
+    {
+      /* Start past any sequence number left in an old journal,
+         so that none of its transactions can be replayed. */
+      next_seq = header->magic == JOURNAL_MAGIC ? header->seq + LOG_SECTORS : 1;
+    }
+  else if (header->magic != JOURNAL_MAGIC)
+    PANIC ("file system has no journal; reformat it");
+  else
+    next_seq = replay (header->seq);
+  write_header ();
+
+  thread_create ("journal", PRI_DEFAULT, commit_thread, NULL);
+}
+
+/* Starts an operation that changes metadata, or a nested part of
+   one. */
+void
+journal_begin (void)
+{
+  if (lock_held_by_current_thread (&journal_lock))
+    depth++;
+  else
+    {
+      lock_acquire (&journal_lock);
+      depth = 1;
+    }
+}
+
+/* Ends what the matching journal_begin() started. */
+void
+journal_end (void)
+{
+  ASSERT (lock_held_by_current_thread (&journal_lock));
+  ASSERT (depth > 0);
+
+  if (--depth == 0)
+    {
+      if (txn_block_cnt + txn_revoke_cnt >= COMMIT_BATCH)
+        commit ();
+      lock_release (&journal_lock);
+    }
+}
+
+/* Writes SIZE bytes from BUFFER to SECTOR, starting at byte OFS,
+   as part of the running transaction.  Must be called between
+   journal_begin() and journal_end(). */
+void
+journal_write (block_sector_t sector, const void *buffer_, int ofs, int size)
+{
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&journal_lock));
+
+  for (i = 0; i < txn_block_cnt; i++)
+    if (txn_blocks[i] == sector)
+      break;
+  if (i == txn_block_cnt)
+    {
+      if (txn_block_cnt == TXN_MAX
+          || txn_block_cnt + txn_revoke_cnt == DESC_MAX)
+        commit ();
+      reserve ();
+      txn_blocks[txn_block_cnt++] = sector;
+      if (!bitmap_test (logged, sector))
+        {
+          ASSERT (logged_cnt < LOG_SECTORS);
+          bitmap_mark (logged, sector);
+          logged_list[logged_cnt++] = sector;
+        }
+    }
+
+  /* Writing a sector again cancels its revocation. */
+  for (i = 0; i < txn_revoke_cnt; i++)
+    if (txn_revokes[i] == sector)
+      {
+        txn_revokes[i] = txn_revokes[--txn_revoke_cnt];
+        break;
+      }
+
+  cache_write_uncommitted (sector, buffer_, ofs, size);
+}
+
+/* Records in the running transaction that the CNT sectors
+   starting at SECTOR have been freed.  Must be called between
+   journal_begin() and journal_end(). */
+void
+journal_revoke (block_sector_t sector, size_t cnt)
+{
+  size_t i, j;
+
+  ASSERT (lock_held_by_current_thread (&journal_lock));
+
+  for (i = 0; i < cnt; i++, sector++)
+    {
+      if (!bitmap_test (logged, sector))
+        continue;
+      for (j = 0; j < txn_revoke_cnt; j++)
+        if (txn_revokes[j] == sector)
+          break;
+      if (j < txn_revoke_cnt)
+        continue;
+
+      if (txn_block_cnt + txn_revoke_cnt == DESC_MAX)
+        commit ();
+      reserve ();
+      txn_revokes[txn_revoke_cnt++] = sector;
+      revoke_cnt++;
+    }
+}
+
+/* Commits the running transaction. */
+void
+journal_flush (void)
+{
+  journal_begin ();
+  commit ();
+  journal_end ();
+}
+
+/* Prints journal statistics. */
+void
+journal_print_stats (void)
+{
+  printf ("Journal: %llu transactions, %llu sectors logged, "
+          "%llu revoked, %llu checkpoints\n",
+          commit_cnt, block_cnt, revoke_cnt, checkpoint_cnt);
+}
+
+/* 周期性地提交正在进行的事务。 */
+static void
+commit_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (COMMIT_INTERVAL);
+      journal_flush ();
+    }
+}
+
+/* 若DESCS[I]之后(含)的事务撤销了SECTOR，返回真。 */
+static bool
+revoked (const struct journal_desc *descs, size_t i, size_t cnt,
+         block_sector_t sector)
+{
+  for (; i < cnt; i++)
+    {
+      const struct journal_desc *d = &descs[i];
+      size_t k;
+
+      for (k = d->block_cnt; k < d->block_cnt + d->revoke_cnt; k++)
+        if (d->sectors[k] == sector)
+          return true;
+    }
+  return false;
+}
+
+/* 重放日志中从序号SEQ开始的已提交事务，把修改写回原位。
+   返回最后一个重放的事务之后的序号。 */
+static uint32_t
+replay (uint32_t seq)
+{
+  struct journal_desc *descs;
+  size_t txn_cnt = 0, sector_cnt = 0;
+  size_t pos, i, k;
+
+  descs = malloc (LOG_SECTORS / 2 * sizeof *descs);
+  if (descs == NULL)
+    PANIC ("journal replay: out of memory");
+
+  /* 找出所有完整的事务。 */
+  for (pos = 0; pos + 2 <= LOG_SECTORS; )
+    {
+      struct journal_desc *d = &descs[txn_cnt];
+
+      block_read (fs_device, log_sector (pos), buffer);
+      memcpy (d, buffer, sizeof *d);
+      if (d->magic != DESC_MAGIC || d->seq != seq
+          || d->block_cnt > TXN_MAX
+          || d->block_cnt + d->revoke_cnt > DESC_MAX
+          || pos + d->block_cnt + 2 > LOG_SECTORS)
+        break;
+      block_read (fs_device, log_sector (pos + 1 + d->block_cnt),
+                  &commit_block);
+      if (commit_block.magic != COMMIT_MAGIC || commit_block.seq != seq)
+        break;
+      txn_cnt++;
+      seq++;
+      pos += d->block_cnt + 2;
+    }
+
+  /* 按顺序写回，跳过之后被撤销的扇区。 */
+  for (pos = 0, i = 0; i < txn_cnt; pos += descs[i].block_cnt + 2, i++)
+    {
+      if (descs[i].block_cnt == 0)
+        continue;
+      block_read_multi (fs_device, log_sector (pos + 1), descs[i].block_cnt,
+                        log_buffer);
+      for (k = 0; k < descs[i].block_cnt; k++)
+        {
+          block_sector_t sector = descs[i].sectors[k];
+          if (revoked (descs, i, txn_cnt, sector))
+            continue;
+          block_write (fs_device, sector, log_buffer + k * BLOCK_SECTOR_SIZE);
+          sector_cnt++;
+        }
+    }
+  free (descs);
+
+  if (txn_cnt > 0)
+    printf ("Journal: replayed %zu transactions (%zu sectors).\n",
+            txn_cnt, sector_cnt);
+  return seq;
+}
+
+/* 把日志头写到磁盘，清空日志。之前的事务都不会再被重放。 */
+static void
+write_header (void)
+{
+  struct journal_header *header = (struct journal_header *) buffer;
+
+  memset (header, 0, sizeof *header);
+  header->magic = JOURNAL_MAGIC;
+  header->seq = next_seq;
+  block_write (fs_device, JOURNAL_SECTOR, header);
+  log_pos = 0;
+}
+
+/* 把正在进行的事务写入日志：描述块和修改的扇区用一次请求写入，
+   之后才写提交块。然后允许缓存把修改过的扇区写回。 */
+static void
+commit (void)
+{
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&journal_lock));
+
+  if (txn_block_cnt == 0 && txn_revoke_cnt == 0)
+    return;
+  ASSERT (log_pos + txn_block_cnt + 2 <= LOG_SECTORS);
+
+  memset (&desc, 0, sizeof desc);
+  desc.magic = DESC_MAGIC;
+  desc.seq = next_seq;
+  desc.block_cnt = txn_block_cnt;
+  desc.revoke_cnt = txn_revoke_cnt;
+  memcpy (desc.sectors, txn_blocks, txn_block_cnt * sizeof *txn_blocks);
+  memcpy (desc.sectors + txn_block_cnt, txn_revokes,
+          txn_revoke_cnt * sizeof *txn_revokes);
+  memset (log_buffer, 0, BLOCK_SECTOR_SIZE);
+  memcpy (log_buffer, &desc, sizeof desc);
+  for (i = 0; i < txn_block_cnt; i++)
+    cache_read (txn_blocks[i], log_buffer + (i + 1) * BLOCK_SECTOR_SIZE,
+                0, BLOCK_SECTOR_SIZE);
+  block_write_multi (fs_device, log_sector (log_pos), txn_block_cnt + 1,
+                     log_buffer);
+
+  memset (&commit_block, 0, sizeof commit_block);
+  commit_block.magic = COMMIT_MAGIC;
+  commit_block.seq = next_seq;
+  block_write (fs_device, log_sector (log_pos + 1 + txn_block_cnt),
+               &commit_block);
+
+  for (i = 0; i < txn_block_cnt; i++)
+    cache_commit (txn_blocks[i]);
+
+  log_pos += txn_block_cnt + 2;
+  next_seq++;
+  commit_cnt++;
+  block_cnt += txn_block_cnt;
+  txn_block_cnt = txn_revoke_cnt = 0;
+}
+
+/* 事务开始时，若日志放不下一个最大的事务，先做检查点：把所有脏
+   缓存写回原位，再清空日志。此时没有未提交的修改。 */
+static void
+reserve (void)
+{
+  size_t i;
+
+  if (txn_block_cnt > 0 || txn_revoke_cnt > 0
+      || log_pos + TXN_MAX + 2 <= LOG_SECTORS)
+    return;
+
+  cache_flush ();
+  write_header ();
+  for (i = 0; i < logged_cnt; i++)
+    bitmap_reset (logged, logged_list[i]);
+  logged_cnt = 0;
+  checkpoint_cnt++;
+}
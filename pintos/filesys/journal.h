@@ -0,0 +1,19 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/block.h"
+
+/* Number of sectors in the journal, starting at JOURNAL_SECTOR. */
+#define JOURNAL_SECTORS 128
+
+void journal_init (bool format);
+void journal_begin (void);
+void journal_end (void);
+void journal_write (block_sector_t, const void *buffer, int ofs, int size);
+void journal_revoke (block_sector_t, size_t cnt);
+void journal_flush (void);
+void journal_print_stats (void);
+
+#endif /* filesys/journal.h */
@@ -0,0 +1,82 @@
+/* Creates 1,000 threads that sleep until staggered wake-up
+   times, a few threads per tick, and reports how many alarms the
+   timer interrupt handler had to examine per interrupt while
+   they slept.  With a sorted alarm list this should stay close
+   to the number of threads actually woken on each tick, no
+   matter how many threads are asleep. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define SLEEPER_CNT 1000        /* Number of sleeping threads. */
+#define SPREAD 250              /* Wake-ups are spread over this many ticks. */
+
+static thread_func sleeper;
+static int64_t start_time;
+static struct semaphore done_sema;
+static int early_cnt;
+
+void
+test_alarm_scale (void) 
+{
+  int64_t examined, interrupts;
+  int64_t start_examined, start_ticks;
+  int per_interrupt;
+  int i;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  msg ("Creating %d threads to sleep over %d ticks.", SLEEPER_CNT, SPREAD);
+
+  sema_init (&done_sema, 0);
+  start_time = timer_ticks () + 2 * TIMER_FREQ;
+  for (i = 0; i < SLEEPER_CNT; i++)
+    {
+      char name[16];
+      snprintf (name, sizeof name, "sleeper %d", i);
+      if (thread_create (name, PRI_DEFAULT, sleeper, (void *) i) == TID_ERROR)
+        fail ("couldn't create thread %d", i);
+    }
+
+  /* Start measuring just before the first wake-up. */
+  timer_sleep (start_time - timer_ticks ());
+  start_examined = timer_alarms_examined ();
+  start_ticks = timer_ticks ();
+
+  for (i = 0; i < SLEEPER_CNT; i++)
+    sema_down (&done_sema);
+
+  examined = timer_alarms_examined () - start_examined;
+  interrupts = timer_ticks () - start_ticks;
+  if (interrupts == 0)
+    interrupts = 1;
+  per_interrupt = examined * 100 / interrupts;
+
+  if (early_cnt != 0)
+    fail ("%d threads woke up early", early_cnt);
+  msg ("All %d threads woke up.", SLEEPER_CNT);
+  msg ("Examined %lld alarms in %lld timer interrupts "
+       "(%d.%02d per interrupt).",
+       examined, interrupts, per_interrupt / 100, per_interrupt % 100);
+}
+
+/* Sleeper thread.  Sleeps until its staggered wake-up time and
+   then checks that it did not wake up before it. */
+static void
+sleeper (void *idx_) 
+{
+  int idx = (int) idx_;
+  int64_t wake_time = start_time + 1 + idx % SPREAD;
+
+  timer_sleep (wake_time - timer_ticks ());
+  if (timer_ticks () < wake_time)
+    early_cnt++;
+
+  sema_up (&done_sema);
+}
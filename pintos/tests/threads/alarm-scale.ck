@@ -0,0 +1,26 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+
+fail "Not all sleepers woke up.\n"
+  if !grep (/All 1000 threads woke up\./, @output);
+
+local ($_);
+my ($examined, $interrupts);
+foreach (@output) {
+    ($examined, $interrupts) = /Examined (\d+) alarms in (\d+) timer/
+      and last;
+}
+fail "Missing alarm statistics.\n" if !defined $examined;
+
+# Each interrupt should only look at the alarms it wakes, plus at
+# most one that is not yet due.
+fail "Timer interrupt examined $examined alarms for 1000 wake-ups "
+  . "in $interrupts interrupts.\n"
+  if $examined > 1000 + $interrupts;
+pass;
@@ -0,0 +1,88 @@
+/* Creates thousands of short-lived threads one after another,
+   each of which allocates and frees a few kernel and user pages
+   the way a process does when it is created, loaded, and exits.
+   Reports the number of pages allocated per second.  Run as
+   palloc-storm-nomags, the kernel is booted with "-nomags", so
+   the storm runs with the per-thread page magazines turned off
+   and gives the baseline to compare against. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define CHILD_CNT 2000          /* Number of threads. */
+#define KERNEL_PAGES 3          /* Kernel pages per child, besides its own. */
+#define USER_PAGES 12           /* User pages per child. */
+
+static thread_func child;
+static struct semaphore done_sema;
+static int fail_cnt;
+
+static int64_t run_storm (void);
+
+void
+test_palloc_storm (void) 
+{
+  int64_t pages = (int64_t) CHILD_CNT * (1 + KERNEL_PAGES + USER_PAGES);
+  int64_t elapsed;
+
+  msg ("Creating %d threads, %d pages each.",
+       CHILD_CNT, 1 + KERNEL_PAGES + USER_PAGES);
+
+  sema_init (&done_sema, 0);
+  elapsed = run_storm ();
+
+  if (fail_cnt != 0)
+    fail ("%d page allocations failed", fail_cnt);
+  msg ("All threads ran.");
+  msg ("%s magazines: %lld pages in %lld ticks (%lld pages/s).",
+       palloc_magazines_enabled ? "With" : "Without",
+       pages, elapsed, pages * TIMER_FREQ / elapsed);
+}
+
+/* Runs the storm and returns the number of ticks it took (at
+   least 1). */
+static int64_t
+run_storm (void)
+{
+  int64_t start, elapsed;
+  int i;
+
+  start = timer_ticks ();
+  for (i = 0; i < CHILD_CNT; i++)
+    {
+      if (thread_create ("child", PRI_DEFAULT, child, NULL) == TID_ERROR)
+        fail ("couldn't create thread %d", i);
+      sema_down (&done_sema);
+    }
+  elapsed = timer_elapsed (start);
+  return elapsed > 0 ? elapsed : 1;
+}
+
+/* Child thread.  Allocates and frees pages like a process that
+   sets up a page directory and loads a small program. */
+static void
+child (void *aux UNUSED) 
+{
+  void *kpages[KERNEL_PAGES];
+  void *upages[USER_PAGES];
+  int i;
+
+  for (i = 0; i < KERNEL_PAGES; i++)
+    if ((kpages[i] = palloc_get_page (PAL_ZERO)) == NULL)
+      fail_cnt++;
+  for (i = 0; i < USER_PAGES; i++)
+    if ((upages[i] = palloc_get_page (PAL_USER)) == NULL)
+      fail_cnt++;
+
+  for (i = 0; i < USER_PAGES; i++)
+    palloc_free_page (upages[i]);
+  for (i = 0; i < KERNEL_PAGES; i++)
+    palloc_free_page (kpages[i]);
+
+  sema_up (&done_sema);
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+
+fail "Not all threads ran.\n"
+  if !grep (/All threads ran\./, @output);
+fail "Missing timing with magazines.\n"
+  if !grep (/With magazines: \d+ pages in \d+ ticks \(\d+ pages\/s\)\./,
+	    @output);
+pass;
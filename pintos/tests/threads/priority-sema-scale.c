@@ -0,0 +1,154 @@
+/* Parks 256 threads of assorted priorities on a semaphore, then
+   has the main thread ping-pong with a higher-priority partner
+   through that same semaphore and reports how long the round
+   trips took.  Each sema_up() wakes the partner, which must be
+   found ahead of all of the parked waiters, so the cost of a
+   round trip shows how wake-up scales with the number of
+   waiters.  Runs the round trips twice and reports both times:
+   first as a baseline that also scans a private copy of the
+   waiter list for the highest priority before each sema_up(),
+   the way sema_up() did before the waiters were kept sorted,
+   then with sema_up() alone.  Finally releases the parked
+   threads and checks that they wake up in priority order. */
+
+#include <stdio.h>
+#include <list.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define WAITER_CNT 256          /* Number of parked waiters. */
+#define ROUND_TRIPS 20000       /* Number of ping-pong round trips. */
+
+static thread_func parked_thread;
+static thread_func partner_thread;
+static struct semaphore ping, pong;
+static int last_priority;
+static int woken_cnt;
+static int out_of_order_cnt;
+
+/* Private copy of the waiters on PING, for the scanning baseline. */
+struct waiter_copy
+  {
+    struct list_elem elem;
+    int priority;
+  };
+static struct waiter_copy copies[WAITER_CNT + 1];
+static struct list copy_list;
+
+static list_less_func priority_greater;
+
+static int64_t run_round_trips (bool scan);
+
+void
+test_priority_sema_scale (void) 
+{
+  int64_t scanned, sorted;
+  int i;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  sema_init (&ping, 0);
+  sema_init (&pong, 0);
+
+  /* Parked threads run as soon as they are created, because
+     they have higher priority than us, and block on PING. */
+  msg ("Parking %d threads on a semaphore.", WAITER_CNT);
+  for (i = 0; i < WAITER_CNT; i++) 
+    {
+      int priority = PRI_DEFAULT + 1 + i % (PRI_MAX - PRI_DEFAULT - 1);
+      char name[16];
+      snprintf (name, sizeof name, "parked %d", i);
+      if (thread_create (name, priority, parked_thread, NULL) == TID_ERROR)
+        fail ("couldn't create thread %d", i);
+      copies[i].priority = priority;
+    }
+
+  /* The partner is always last in the copy, as it was when
+     sema_down() appended waiters. */
+  list_init (&copy_list);
+  copies[WAITER_CNT].priority = PRI_MAX;
+  for (i = 0; i <= WAITER_CNT; i++)
+    list_push_back (&copy_list, &copies[i].elem);
+
+  scanned = run_round_trips (true);
+  sorted = run_round_trips (false);
+  msg ("Scanning: %d round trips past %d waiters took %lld ticks.",
+       ROUND_TRIPS, WAITER_CNT, scanned);
+  msg ("Sorted: %d round trips past %d waiters took %lld ticks.",
+       ROUND_TRIPS, WAITER_CNT, sorted);
+
+  /* Release the parked threads.  Each one preempts us as soon as
+     it wakes up. */
+  last_priority = PRI_MAX;
+  for (i = 0; i < WAITER_CNT; i++)
+    sema_up (&ping);
+
+  if (woken_cnt != WAITER_CNT)
+    fail ("only %d of %d parked threads woke up", woken_cnt, WAITER_CNT);
+  if (out_of_order_cnt != 0)
+    fail ("%d parked threads woke up out of priority order",
+          out_of_order_cnt);
+  msg ("Parked threads woke up in priority order.");
+}
+
+/* Ping-pongs ROUND_TRIPS times with a new partner thread and
+   returns the number of ticks it took.  If SCAN is true, scans
+   the copy of the waiter list before each sema_up().  The
+   partner exits at the end, so only the parked threads are left
+   waiting on PING. */
+static int64_t
+run_round_trips (bool scan)
+{
+  int64_t start;
+  int i;
+
+  thread_create ("partner", PRI_MAX, partner_thread, NULL);
+
+  start = timer_ticks ();
+  for (i = 0; i < ROUND_TRIPS; i++) 
+    {
+      if (scan && list_min (&copy_list, priority_greater, NULL)
+                  != &copies[WAITER_CNT].elem)
+        fail ("scan did not find the partner");
+      sema_up (&ping);
+      sema_down (&pong);
+    }
+  return timer_elapsed (start);
+}
+
+/* Orders copies of waiters with the highest priority first. */
+static bool
+priority_greater (const struct list_elem *a_, const struct list_elem *b_,
+                  void *aux UNUSED)
+{
+  const struct waiter_copy *a = list_entry (a_, struct waiter_copy, elem);
+  const struct waiter_copy *b = list_entry (b_, struct waiter_copy, elem);
+
+  return a->priority > b->priority;
+}
+
+static void
+parked_thread (void *aux UNUSED) 
+{
+  sema_down (&ping);
+  if (thread_get_priority () > last_priority)
+    out_of_order_cnt++;
+  last_priority = thread_get_priority ();
+  woken_cnt++;
+}
+
+static void
+partner_thread (void *aux UNUSED) 
+{
+  int i;
+
+  for (i = 0; i < ROUND_TRIPS; i++) 
+    {
+      sema_down (&ping);
+      sema_up (&pong);
+    }
+}
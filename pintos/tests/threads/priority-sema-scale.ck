@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+
+fail "Missing round-trip timing with scanning.\n"
+  if !grep (/Scanning: \d+ round trips past 256 waiters took \d+ ticks\./,
+	    @output);
+fail "Missing round-trip timing with sorted waiters.\n"
+  if !grep (/Sorted: \d+ round trips past 256 waiters took \d+ ticks\./,
+	    @output);
+fail "Parked threads did not wake up in priority order.\n"
+  if !grep (/Parked threads woke up in priority order\./, @output);
+pass;
@@ -0,0 +1,56 @@
+/* Starts several reader threads that each hold a readers-writer
+   lock across a sleep, and checks that all of them hold it at
+   the same time.  The main thread then acquires the lock for
+   writing, which must wait until every reader has left. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define READER_CNT 8
+
+static thread_func reader_thread_func;
+static struct rwlock rwlock;
+static int inside_cnt;
+static int max_inside_cnt;
+static int left_cnt;
+
+void
+test_rwlock_readers (void) 
+{
+  int i;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  rwlock_init (&rwlock);
+
+  msg ("Starting %d readers.", READER_CNT);
+  for (i = 0; i < READER_CNT; i++) 
+    {
+      char name[16];
+      snprintf (name, sizeof name, "reader %d", i);
+      thread_create (name, PRI_DEFAULT, reader_thread_func, NULL);
+    }
+
+  rwlock_acquire_write (&rwlock);
+  msg ("%d readers held the lock at the same time.", max_inside_cnt);
+  msg ("Writer got the lock after %d of %d readers left.",
+       left_cnt, READER_CNT);
+  rwlock_release_write (&rwlock);
+}
+
+static void
+reader_thread_func (void *aux UNUSED) 
+{
+  rwlock_acquire_read (&rwlock);
+  if (++inside_cnt > max_inside_cnt)
+    max_inside_cnt = inside_cnt;
+  timer_sleep (10);
+  inside_cnt--;
+  left_cnt++;
+  rwlock_release_read (&rwlock);
+}
@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(rwlock-readers) begin
+(rwlock-readers) Starting 8 readers.
+(rwlock-readers) 8 readers held the lock at the same time.
+(rwlock-readers) Writer got the lock after 8 of 8 readers left.
+(rwlock-readers) end
+EOF
+pass;
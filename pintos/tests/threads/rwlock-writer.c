@@ -0,0 +1,53 @@
+/* The main thread holds a readers-writer lock for reading.  A
+   writer then waits for it, and after that a higher-priority
+   reader arrives.  The reader must not get in ahead of the
+   waiting writer, so the writer waits only for the reader that
+   was already inside.  While it waits for the writer, the reader
+   donates its priority to it. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+static thread_func writer_thread_func;
+static thread_func reader_thread_func;
+static struct rwlock rwlock;
+
+void
+test_rwlock_writer (void) 
+{
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  /* Make sure our priority is the default. */
+  ASSERT (thread_get_priority () == PRI_DEFAULT);
+
+  rwlock_init (&rwlock);
+  rwlock_acquire_read (&rwlock);
+  msg ("Main thread holds the lock for reading.");
+
+  thread_create ("writer", PRI_DEFAULT + 1, writer_thread_func, NULL);
+  thread_create ("reader", PRI_DEFAULT + 2, reader_thread_func, NULL);
+
+  msg ("Main thread releasing the lock.");
+  rwlock_release_read (&rwlock);
+}
+
+static void
+writer_thread_func (void *aux UNUSED) 
+{
+  rwlock_acquire_write (&rwlock);
+  msg ("Writer acquired the lock with priority %d.", thread_get_priority ());
+  rwlock_release_write (&rwlock);
+  msg ("Writer finished with priority %d.", thread_get_priority ());
+}
+
+static void
+reader_thread_func (void *aux UNUSED) 
+{
+  rwlock_acquire_read (&rwlock);
+  msg ("Reader acquired the lock.");
+  rwlock_release_read (&rwlock);
+}
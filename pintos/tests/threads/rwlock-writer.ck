@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(rwlock-writer) begin
+(rwlock-writer) Main thread holds the lock for reading.
+(rwlock-writer) Main thread releasing the lock.
+(rwlock-writer) Writer acquired the lock with priority 33.
+(rwlock-writer) Reader acquired the lock.
+(rwlock-writer) Writer finished with priority 32.
+(rwlock-writer) end
+EOF
+pass;
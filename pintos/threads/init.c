@@ -21,6 +21,7 @@
 #include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/pte.h"
+#include "threads/slab.h"
 #include "threads/thread.h"
 #ifdef USERPROG
 #include "userprog/process.h"
@@ -34,9 +35,15 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "devices/ramdisk.h"
+#include "devices/stripe.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
+#ifdef VM
+#include "vm/page.h"
+#include "vm/swap.h"
+#endif
 
 /* Page directory with kernel mappings only. */
 uint32_t *init_page_dir;
@@ -52,6 +59,13 @@ static const char *scratch_bdev_name;
 #ifdef VM
 static const char *swap_bdev_name;
 #endif
+
+/* -ramdisk: Size in kB of RAM disk "ram0", or 0 for none. */
+static size_t ramdisk_kb;
+
+/* -stripe: Comma-separated names of block devices to stripe
+   together into "md0". */
+static char *stripe_bdev_names;
 #endif /* FILESYS */
 
 /* -ul: Maximum number of pages to put into palloc's user pool. */
@@ -68,6 +82,7 @@ static void usage (void);
 #ifdef FILESYS
 static void locate_block_devices (void);
 static void locate_block_device (enum block_type, const char *name);
+static void register_stripe (char *names);
 #endif
 
 int main (void) NO_RETURN;
@@ -97,6 +112,7 @@ main (void)
   /* Initialize memory system. */
   palloc_init (user_page_limit);
   malloc_init ();
+  slab_init ();
   paging_init ();
 
   /* Segmentation. */
@@ -127,6 +143,12 @@ main (void)
   filesys_init (format_filesys);
 #endif
 
+#ifdef VM
+  /* Initialize virtual memory. */
+  page_init ();
+  swap_init ();
+#endif
+
   printf ("Boot complete.\n");
   
   printf ("qhm\n");
@@ -249,6 +271,10 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-ramdisk"))
+        ramdisk_kb = atoi (value);
+      else if (!strcmp (name, "-stripe"))
+        stripe_bdev_names = value;
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -258,6 +284,10 @@ parse_options (char **argv)
         random_init (atoi (value));
       else if (!strcmp (name, "-mlfqs"))
         thread_mlfqs = true;
+      else if (!strcmp (name, "-lockstat"))
+        lock_stat_enabled = true;
+      else if (!strcmp (name, "-nomags"))
+        palloc_magazines_enabled = false;
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
@@ -317,6 +347,11 @@ run_actions (char **argv)
       {"rm", 2, fsutil_rm},
       {"extract", 1, fsutil_extract},
       {"append", 2, fsutil_append},
+      {"frag", 1, fsutil_frag},
+      {"seqbench", 2, fsutil_seqbench},
+      {"dirbench", 2, fsutil_dirbench},
+      {"inodestress", 2, fsutil_inodestress},
+      {"dmabench", 2, fsutil_dmabench},
 #endif
       {NULL, 0, NULL},
     };
@@ -363,6 +398,11 @@ usage (void)
           "  ls                 List files in the root directory.\n"
           "  cat FILE           Print FILE to the console.\n"
           "  rm FILE            Delete FILE.\n"
+          "  frag               Report file and free space fragmentation.\n"
+          "  seqbench KB        Time writing and reading a KB-kB file.\n"
+          "  dirbench N         Time creating, opening, deleting N files.\n"
+          "  inodestress N      Open and close N inodes from many threads.\n"
+          "  dmabench KB        Compare idle time reading a KB-kB file, DMA vs PIO.\n"
           "Use these actions indirectly via `pintos' -g and -p options:\n"
           "  extract            Untar from scratch device into file system.\n"
           "  append FILE        Append FILE to tar file on scratch device.\n"
@@ -375,12 +415,16 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -ramdisk=KB        Create a KB-kB RAM disk as block device ram0.\n"
+          "  -stripe=BDEV,...   Stripe BDEVs together into block device md0.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
+          "  -lockstat          Print lock contention statistics at shutdown.\n"
+          "  -nomags            Do not cache free pages per thread.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
 #endif
@@ -393,6 +437,10 @@ usage (void)
 static void
 locate_block_devices (void)
 {
+  if (ramdisk_kb > 0)
+    ramdisk_register ("ram0", ramdisk_kb);
+  if (stripe_bdev_names != NULL)
+    register_stripe (stripe_bdev_names);
   locate_block_device (BLOCK_FILESYS, filesys_bdev_name);
   locate_block_device (BLOCK_SCRATCH, scratch_bdev_name);
 #ifdef VM
@@ -428,4 +476,29 @@ locate_block_device (enum block_type role, const char *name)
       block_set_role (role, block);
     }
 }
+
+/* Registers block device "md0", striped across the block
+   devices named in comma-separated list NAMES. */
+static void
+register_stripe (char *names)
+{
+  struct block *members[STRIPE_MAX];
+  size_t member_cnt = 0;
+  char *name, *save_ptr;
+
+  for (name = strtok_r (names, ",", &save_ptr); name != NULL;
+       name = strtok_r (NULL, ",", &save_ptr))
+    {
+      if (member_cnt >= STRIPE_MAX)
+        PANIC ("-stripe: at most %d block devices", STRIPE_MAX);
+      members[member_cnt] = block_get_by_name (name);
+      if (members[member_cnt] == NULL)
+        PANIC ("No such block device \"%s\"", name);
+      member_cnt++;
+    }
+  if (member_cnt == 0)
+    PANIC ("-stripe: no block devices given");
+
+  stripe_register ("md0", members, member_cnt);
+}
 #endif
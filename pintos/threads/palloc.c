@@ -1,14 +1,16 @@
 #include "threads/palloc.h"
-#include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include "threads/loader.h"
+#include "threads/interrupt.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
 
 /* Page allocator.  Hands out memory in page-size (or
@@ -23,22 +25,106 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   Within a pool, pages are managed by a binary buddy allocator.
+   Free memory is kept as blocks of 2**ORDER pages, each aligned
+   (relative to the pool base) to its own size, on one free list
+   per order.  A request for PAGE_CNT pages takes the smallest
+   free block that is big enough, splitting larger blocks in half
+   as needed, and gives the unused tail of the block back.
+   Freeing a range of pages breaks it into aligned blocks and
+   merges each one with its "buddy", the other half of the block
+   of the next larger order, for as long as the buddy is free.
+   Both operations take O(log n) time in the size of the pool,
+   apart from the pages' contents being cleared.
+
+   A free block keeps its free list element in its own first
+   page.  The only other bookkeeping is one byte per page, at the
+   base of the pool, that gives the order of the free block that
+   starts at that page, if any.
+
+   In front of the pools, each thread keeps a small "magazine" of
+   free single pages per pool.  palloc_get_page() and
+   palloc_free_page() normally just pop or push a page there,
+   without taking the pool's lock.  An empty magazine is refilled,
+   and an overfull one drained, MAG_BATCH pages at a time under a
+   single acquisition of the lock.  A thread's magazines are
+   emptied back into the pools when it exits.  When a pool runs
+   out, the pages sitting in every thread's magazine for it are
+   taken back before the allocation is allowed to fail, so pages
+   are never stranded in idle threads' magazines.  For that to
+   be safe, magazines are only changed with interrupts off.
+
+   Pages freed with interrupts off, which happens when a dying
+   thread's page is freed in thread_schedule_tail(), cannot take
+   the lock.  They are put on the pool's "pending" list and given
+   back to the buddy allocator the next time the lock is held. */
+
+/* Number of buddy orders: blocks of 1, 2, 4, ..., 2**(N-1)
+   pages. */
+#define ORDER_CNT 20
+
+/* Value in a pool's order_map for a page that does not begin a
+   free block. */
+#define NOT_FREE (-1)
+
+/* Most pages a magazine holds after palloc_free_page(), and
+   the number of pages moved between a magazine and its pool at
+   once. */
+#define MAG_SIZE 16
+#define MAG_BATCH 8
 
 /* A memory pool. */
 struct pool
   {
     struct lock lock;                   /* Mutual exclusion. */
-    struct bitmap *used_map;            /* Bitmap of free pages. */
+    const char *name;                   /* Name, for statistics. */
     uint8_t *base;                      /* Base of pool. */
+    size_t page_cnt;                    /* Number of pages in pool. */
+    int8_t *order_map;                  /* 每页开始的空闲块的阶数，或NOT_FREE */
+    struct list free_lists[ORDER_CNT];  /* 每个阶的空闲块 */
+    size_t free_cnt;                    /* 空闲页数 */
+    void *pending;                      /* 关中断时释放的页，见上 */
+
+    /* Statistics. */
+    unsigned long long alloc_cnt;       /* 成功分配的次数 */
+    unsigned long long fail_cnt;        /* 分配失败的次数 */
+    unsigned long long split_cnt;       /* 拆分块的次数 */
+    unsigned long long merge_cnt;       /* 与伙伴合并的次数 */
+    unsigned long long mag_hit_cnt;     /* 直接从弹匣分配的次数，不加锁计数 */
+    unsigned long long refill_cnt;      /* 填充弹匣的次数 */
+    unsigned long long drain_cnt;       /* 清空弹匣的次数 */
+    unsigned long long steal_cnt;       /* 从所有线程弹匣收回页的次数 */
+  };
+
+/* A free block, stored in its own first page. */
+struct free_block
+  {
+    struct list_elem elem;              /* Element in free list. */
   };
 
 /* Two pools: one for kernel data, one for user pages. */
 static struct pool kernel_pool, user_pool;
 
+/* If false, palloc_get_page() and palloc_free_page() bypass
+   the per-thread magazines.
+   Controlled by kernel command-line option "-nomags". */
+bool palloc_magazines_enabled = true;
+
 static void init_pool (struct pool *, void *base, size_t page_cnt,
                        const char *name);
 static bool page_from_pool (const struct pool *, void *page);
+static size_t buddy_alloc (struct pool *, size_t page_cnt);
+static void buddy_free_range (struct pool *, size_t page_idx,
+                              size_t page_cnt);
+static void print_pool_stats (struct pool *);
+static void *magazine_get (struct pool *);
+static void magazine_put (struct pool *, void *page);
+static void magazine_drain (struct pool *, struct page_magazine *,
+                            size_t keep_cnt);
+static void reclaim_pending (struct pool *);
+static bool reclaim_magazines (struct pool *);
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
    pages are put into the user pool. */
@@ -77,11 +163,30 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
   if (page_cnt == 0)
     return NULL;
 
+  /* 单页请求先从当前线程的弹匣中取。 */
+  if (page_cnt == 1 && palloc_magazines_enabled)
+    {
+      pages = magazine_get (pool);
+      if (pages != NULL)
+        {
+          if (flags & PAL_ZERO)
+            memset (pages, 0, PGSIZE);
+          return pages;
+        }
+    }
+
   lock_acquire (&pool->lock);
-  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
+  reclaim_pending (pool);
+  page_idx = buddy_alloc (pool, page_cnt);
+  if (page_idx == SIZE_MAX && reclaim_magazines (pool))
+    page_idx = buddy_alloc (pool, page_cnt);
+  if (page_idx != SIZE_MAX)
+    pool->alloc_cnt++;
+  else
+    pool->fail_cnt++;
   lock_release (&pool->lock);
 
-  if (page_idx != BITMAP_ERROR)
+  if (page_idx != SIZE_MAX)
     pages = pool->base + PGSIZE * page_idx;
   else
     pages = NULL;
@@ -132,13 +237,36 @@ palloc_free_multiple (void *pages, size_t page_cnt)
     NOT_REACHED ();
 
   page_idx = pg_no (pages) - pg_no (pool->base);
+  ASSERT (page_idx + page_cnt <= pool->page_cnt);
 
 #ifndef NDEBUG
   memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
 
-  ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
-  bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  if (intr_get_level () == INTR_OFF)
+    {
+      /* 关中断时不能获得锁，先放到pending链表中。 */
+      size_t i;
+
+      for (i = 0; i < page_cnt; i++)
+        {
+          void **page = (void **) ((uint8_t *) pages + PGSIZE * i);
+          *page = pool->pending;
+          pool->pending = page;
+        }
+      return;
+    }
+
+  if (page_cnt == 1 && palloc_magazines_enabled)
+    {
+      magazine_put (pool, pages);
+      return;
+    }
+
+  lock_acquire (&pool->lock);
+  reclaim_pending (pool);
+  buddy_free_range (pool, page_idx, page_cnt);
+  lock_release (&pool->lock);
 }
 
 /* Frees the page at PAGE. */
@@ -148,25 +276,60 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
+/* Returns the pages in the running thread's magazines to their
+   pools.  Called when the thread exits. */
+void
+palloc_drain_magazines (void)
+{
+  struct thread *t = thread_current ();
+
+  magazine_drain (&kernel_pool, &t->page_magazines[0], 0);
+  magazine_drain (&user_pool, &t->page_magazines[1], 0);
+}
+
+/* Prints statistics about the kernel and user pools. */
+void
+palloc_print_stats (void)
+{
+  print_pool_stats (&kernel_pool);
+  print_pool_stats (&user_pool);
+}
+
 /* Initializes pool P as starting at START and ending at END,
    naming it NAME for debugging purposes. */
 static void
 init_pool (struct pool *p, void *base, size_t page_cnt, const char *name) 
 {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
+  /* We'll put the pool's order_map at its base.
+     Calculate the space needed for the map
      and subtract it from the pool's size. */
-  size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (page_cnt), PGSIZE);
-  if (bm_pages > page_cnt)
-    PANIC ("Not enough memory in %s for bitmap.", name);
-  page_cnt -= bm_pages;
+  size_t map_pages = DIV_ROUND_UP (page_cnt, PGSIZE);
+  size_t i;
+
+  if (map_pages > page_cnt)
+    PANIC ("Not enough memory in %s for order map.", name);
+  page_cnt -= map_pages;
 
   printf ("%zu pages available in %s.\n", page_cnt, name);
 
   /* Initialize the pool. */
   lock_init (&p->lock);
-  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
-  p->base = base + bm_pages * PGSIZE;
+  lock_set_name (&p->lock, name);
+  p->name = name;
+  p->base = (uint8_t *) base + map_pages * PGSIZE;
+  p->page_cnt = page_cnt;
+  p->order_map = base;
+  memset (p->order_map, NOT_FREE, page_cnt);
+  for (i = 0; i < ORDER_CNT; i++)
+    list_init (&p->free_lists[i]);
+  p->free_cnt = 0;
+  p->pending = NULL;
+  p->alloc_cnt = p->fail_cnt = p->split_cnt = p->merge_cnt = 0;
+  p->mag_hit_cnt = p->refill_cnt = p->drain_cnt = p->steal_cnt = 0;
+
+  /* Every page starts out free. */
+  buddy_free_range (p, 0, page_cnt);
+  p->merge_cnt = 0;
 }
 
 /* Returns true if PAGE was allocated from POOL,
@@ -176,7 +339,329 @@ page_from_pool (const struct pool *pool, void *page)
 {
   size_t page_no = pg_no (page);
   size_t start_page = pg_no (pool->base);
-  size_t end_page = start_page + bitmap_size (pool->used_map);
+  size_t end_page = start_page + pool->page_cnt;
 
   return page_no >= start_page && page_no < end_page;
 }
+
+/* 返回POOL中第PAGE_IDX页开始的空闲块。 */
+static struct free_block *
+idx_to_block (struct pool *pool, size_t page_idx)
+{
+  return (struct free_block *) (pool->base + PGSIZE * page_idx);
+}
+
+/* 把POOL中从PAGE_IDX开始的ORDER阶的块放入空闲链表。 */
+static void
+block_insert (struct pool *pool, size_t page_idx, int order)
+{
+  struct free_block *b = idx_to_block (pool, page_idx);
+
+  ASSERT (page_idx % ((size_t) 1 << order) == 0);
+  ASSERT (pool->order_map[page_idx] == NOT_FREE);
+
+  pool->order_map[page_idx] = order;
+  list_push_front (&pool->free_lists[order], &b->elem);
+  pool->free_cnt += (size_t) 1 << order;
+}
+
+/* 把POOL中从PAGE_IDX开始的ORDER阶的空闲块从空闲链表中取出。 */
+static void
+block_remove (struct pool *pool, size_t page_idx, int order)
+{
+  struct free_block *b = idx_to_block (pool, page_idx);
+
+  ASSERT (pool->order_map[page_idx] == order);
+
+  pool->order_map[page_idx] = NOT_FREE;
+  list_remove (&b->elem);
+  pool->free_cnt -= (size_t) 1 << order;
+}
+
+/* 释放POOL中从PAGE_IDX开始的ORDER阶的块，只要伙伴块也是空闲的
+   就与之合并成更高一阶的块。 */
+static void
+block_free (struct pool *pool, size_t page_idx, int order)
+{
+  while (order + 1 < ORDER_CNT)
+    {
+      size_t size = (size_t) 1 << order;
+      size_t buddy = page_idx ^ size;
+
+      if (buddy + size > pool->page_cnt
+          || pool->order_map[buddy] != order)
+        break;
+
+      block_remove (pool, buddy, order);
+      page_idx &= ~size;
+      order++;
+      pool->merge_cnt++;
+    }
+  block_insert (pool, page_idx, order);
+}
+
+/* 释放POOL中从PAGE_IDX开始的PAGE_CNT页。这些页被分成尽可能大的
+   对齐的块，再逐个释放。必须持有POOL的锁（初始化时除外）。 */
+static void
+buddy_free_range (struct pool *pool, size_t page_idx, size_t page_cnt)
+{
+  while (page_cnt > 0)
+    {
+      int order = 0;
+
+      while (order + 1 < ORDER_CNT
+             && page_idx % ((size_t) 2 << order) == 0
+             && ((size_t) 2 << order) <= page_cnt)
+        order++;
+
+      block_free (pool, page_idx, order);
+      page_idx += (size_t) 1 << order;
+      page_cnt -= (size_t) 1 << order;
+    }
+}
+
+/* 从POOL中分配PAGE_CNT个连续的页，返回第一页的下标，
+   没有足够大的空闲块时返回SIZE_MAX。必须持有POOL的锁。 */
+static size_t
+buddy_alloc (struct pool *pool, size_t page_cnt)
+{
+  struct free_block *b;
+  size_t page_idx;
+  int need, order;
+
+  ASSERT (lock_held_by_current_thread (&pool->lock));
+
+  /* 能容纳PAGE_CNT页的最小的阶。 */
+  for (need = 0; need < ORDER_CNT && ((size_t) 1 << need) < page_cnt; need++)
+    continue;
+
+  /* 找到不小于NEED阶的最小的空闲块。 */
+  for (order = need; order < ORDER_CNT; order++)
+    if (!list_empty (&pool->free_lists[order]))
+      break;
+  if (order >= ORDER_CNT)
+    return SIZE_MAX;
+
+  b = list_entry (list_front (&pool->free_lists[order]),
+                  struct free_block, elem);
+  page_idx = pg_no (b) - pg_no (pool->base);
+  block_remove (pool, page_idx, order);
+
+  /* 把块一分为二，直到大小合适，后一半放回空闲链表。 */
+  while (order > need)
+    {
+      order--;
+      block_insert (pool, page_idx + ((size_t) 1 << order), order);
+      pool->split_cnt++;
+    }
+
+  /* 把多出来的尾部还回去。 */
+  if (((size_t) 1 << need) > page_cnt)
+    buddy_free_range (pool, page_idx + page_cnt,
+                      ((size_t) 1 << need) - page_cnt);
+
+  return page_idx;
+}
+
+/* 返回当前线程中POOL对应的弹匣。 */
+static struct page_magazine *
+pool_magazine (struct pool *pool)
+{
+  return &thread_current ()->page_magazines[pool == &kernel_pool ? 0 : 1];
+}
+
+/* 把PAGE压入弹匣M。关中断进行，以免reclaim_magazines()同时
+   修改M。 */
+static void
+magazine_push (struct page_magazine *m, void *page_)
+{
+  void **page = page_;
+  enum intr_level old_level = intr_disable ();
+
+  *page = m->top;
+  m->top = page;
+  m->cnt++;
+  intr_set_level (old_level);
+}
+
+/* 从弹匣M弹出一页，M为空时返回空指针。关中断进行。 */
+static void *
+magazine_pop (struct page_magazine *m)
+{
+  void **page;
+  enum intr_level old_level = intr_disable ();
+
+  page = m->top;
+  if (page != NULL)
+    {
+      m->top = *page;
+      m->cnt--;
+    }
+  intr_set_level (old_level);
+  return page;
+}
+
+/* 从当前线程的弹匣中取出POOL的一页，弹匣为空时先从POOL中
+   一次取MAG_BATCH页填充。POOL中没有空闲页时返回空指针。 */
+static void *
+magazine_get (struct pool *pool)
+{
+  struct page_magazine *m;
+  void *page;
+
+  ASSERT (!intr_context ());
+
+  m = pool_magazine (pool);
+  page = magazine_pop (m);
+  if (page != NULL)
+    {
+      pool->mag_hit_cnt++;
+      return page;
+    }
+
+  lock_acquire (&pool->lock);
+  reclaim_pending (pool);
+  while (m->cnt < MAG_BATCH)
+    {
+      size_t page_idx = buddy_alloc (pool, 1);
+      if (page_idx == SIZE_MAX)
+        {
+          /* 池已空。一页也没取到时，先收回其他线程弹匣中的页。 */
+          if (m->cnt > 0 || !reclaim_magazines (pool))
+            break;
+          page_idx = buddy_alloc (pool, 1);
+          if (page_idx == SIZE_MAX)
+            break;
+        }
+      magazine_push (m, pool->base + PGSIZE * page_idx);
+    }
+  pool->refill_cnt++;
+  lock_release (&pool->lock);
+
+  return magazine_pop (m);
+}
+
+/* 把POOL的页PAGE放入当前线程的弹匣，超过MAG_SIZE页时
+   把MAG_BATCH页还给POOL。 */
+static void
+magazine_put (struct pool *pool, void *page_)
+{
+  struct page_magazine *m;
+
+  ASSERT (!intr_context ());
+
+  m = pool_magazine (pool);
+  magazine_push (m, page_);
+  if (m->cnt > MAG_SIZE)
+    magazine_drain (pool, m, MAG_SIZE - MAG_BATCH);
+}
+
+/* 把弹匣M中的页还给POOL，只留下KEEP_CNT页。 */
+static void
+magazine_drain (struct pool *pool, struct page_magazine *m, size_t keep_cnt)
+{
+  if (m->cnt <= keep_cnt)
+    return;
+
+  lock_acquire (&pool->lock);
+  reclaim_pending (pool);
+  while (m->cnt > keep_cnt)
+    {
+      void *page = magazine_pop (m);
+      if (page == NULL)
+        break;
+      buddy_free_range (pool, pg_no (page) - pg_no (pool->base), 1);
+    }
+  pool->drain_cnt++;
+  lock_release (&pool->lock);
+}
+
+/* 把POOL的pending链表中的页还给伙伴分配器。必须持有POOL的锁。 */
+static void
+reclaim_pending (struct pool *pool)
+{
+  enum intr_level old_level;
+  void **page;
+
+  ASSERT (lock_held_by_current_thread (&pool->lock));
+
+  old_level = intr_disable ();
+  page = pool->pending;
+  pool->pending = NULL;
+  intr_set_level (old_level);
+
+  while (page != NULL)
+    {
+      void **next = *page;
+      buddy_free_range (pool, pg_no (page) - pg_no (pool->base), 1);
+      page = next;
+    }
+}
+
+/* thread_foreach()的回调：把线程T中POOL对应弹匣的页全部移到
+   POOL的pending链表。 */
+static void
+steal_magazine (struct thread *t, void *pool_)
+{
+  struct pool *pool = pool_;
+  struct page_magazine *m = &t->page_magazines[pool == &kernel_pool ? 0 : 1];
+  void **page;
+
+  while ((page = magazine_pop (m)) != NULL)
+    {
+      *page = pool->pending;
+      pool->pending = page;
+    }
+}
+
+/* 把所有线程弹匣中POOL的页收回到POOL的伙伴分配器中。POOL分配
+   失败时调用，必须持有POOL的锁。收回了页时返回true。 */
+static bool
+reclaim_magazines (struct pool *pool)
+{
+  enum intr_level old_level;
+  bool found;
+
+  ASSERT (lock_held_by_current_thread (&pool->lock));
+
+  old_level = intr_disable ();
+  thread_foreach (steal_magazine, pool);
+  found = pool->pending != NULL;
+  intr_set_level (old_level);
+
+  if (found)
+    {
+      pool->steal_cnt++;
+      reclaim_pending (pool);
+    }
+  return found;
+}
+
+/* Prints statistics about POOL. */
+static void
+print_pool_stats (struct pool *pool)
+{
+  size_t block_cnt = 0;
+  size_t largest = 0;
+  int order;
+
+  for (order = 0; order < ORDER_CNT; order++)
+    {
+      size_t cnt = list_size (&pool->free_lists[order]);
+      block_cnt += cnt;
+      if (cnt > 0)
+        largest = (size_t) 1 << order;
+    }
+
+  printf ("Palloc %s: %zu pages, %zu free in %zu blocks, "
+          "largest %zu, fragmentation %zu%%\n",
+          pool->name, pool->page_cnt, pool->free_cnt, block_cnt, largest,
+          pool->free_cnt > 0 ? 100 - largest * 100 / pool->free_cnt : 0);
+  printf ("Palloc %s: %llu allocs, %llu failed, %llu splits, "
+          "%llu merges\n",
+          pool->name, pool->alloc_cnt, pool->fail_cnt, pool->split_cnt,
+          pool->merge_cnt);
+  printf ("Palloc %s: %llu magazine hits, %llu refills, %llu drains, "
+          "%llu reclaims\n", pool->name, pool->mag_hit_cnt, pool->refill_cnt,
+          pool->drain_cnt, pool->steal_cnt);
+}
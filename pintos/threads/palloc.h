@@ -1,6 +1,7 @@
 #ifndef THREADS_PALLOC_H
 #define THREADS_PALLOC_H
 
+#include <stdbool.h>
 #include <stddef.h>
 
 /* How to allocate pages. */
@@ -11,10 +12,23 @@ enum palloc_flags
     PAL_USER = 004              /* User page. */
   };
 
+/* Per-thread cache of free pages from one pool.  See palloc.c. */
+struct page_magazine
+  {
+    void *top;                  /* 最后放入的页，每页的第一个字指向下一页 */
+    size_t cnt;                 /* 页数 */
+  };
+
+/* If false, single pages bypass the per-thread magazines.
+   Controlled by kernel command-line option "-nomags". */
+extern bool palloc_magazines_enabled;
+
 void palloc_init (size_t user_page_limit);
 void *palloc_get_page (enum palloc_flags);
 void *palloc_get_multiple (enum palloc_flags, size_t page_cnt);
 void palloc_free_page (void *);
 void palloc_free_multiple (void *, size_t page_cnt);
+void palloc_drain_magazines (void);
+void palloc_print_stats (void);
 
 #endif /* threads/palloc.h */
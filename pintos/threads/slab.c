@@ -0,0 +1,299 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* An object cache ("slab allocator") for fixed-size objects.
+
+   Each cache hands out objects of a single size.  Its memory
+   comes from the page allocator one page at a time; each page,
+   called a "slab", starts with a small header followed by as
+   many objects as fit.  Unlike malloc(), slots are not rounded
+   up to a power of 2, so a 540-byte object takes 540 bytes
+   (plus alignment) instead of 1 kB.
+
+   Every slab keeps its own list of free slots.  The cache keeps
+   the slabs that have free slots on a list, partially used slabs
+   in front of entirely free ones, so allocations fill up used
+   slabs before touching empty ones.  When a slab becomes
+   entirely free it is kept for reuse if it is the cache's only
+   free slab, otherwise it is returned to the page allocator.
+
+   If the cache has a constructor, it runs once on each object
+   when its slab is created, and the object is expected to be
+   back in its constructed state when it is freed.  The free list
+   link of such a cache is kept just past the object so that
+   freeing an object does not disturb its contents.  Without a
+   constructor the link overlays the start of the free object. */
+
+/* Kernel object cache. */
+struct kmem_cache
+  {
+    char name[16];              /* 缓存名，也用作LOCK的名字 */
+    size_t obj_size;            /* 对象的大小 */
+    size_t slot_size;           /* 每个槽的大小，包括空闲链表指针 */
+    size_t link_ofs;            /* 空闲链表指针在槽内的偏移 */
+    size_t objs_per_slab;       /* 每个slab中的对象数 */
+    kmem_ctor_func *ctor;       /* 构造函数，可以为空 */
+    struct list partial;        /* 还有空闲槽的slab */
+    size_t empty_cnt;           /* 完全空闲的slab数，最多为1 */
+    struct lock lock;           /* 保护以上及以下的成员 */
+    struct list_elem elem;      /* cache_list中的元素 */
+
+    /* Statistics. */
+    size_t slab_cnt;            /* 当前的slab数 */
+    size_t peak_slab_cnt;       /* slab数的最大值 */
+    size_t in_use;              /* 已分配出去的对象数 */
+    size_t peak_in_use;         /* in_use的最大值 */
+    unsigned long long alloc_cnt; /* kmem_cache_alloc()成功的次数 */
+    unsigned long long ctor_cnt;  /* 构造函数被调用的次数 */
+  };
+
+/* Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x51ab51ab
+
+/* Slab: one page of objects. */
+struct slab
+  {
+    unsigned magic;             /* Always set to SLAB_MAGIC. */
+    struct kmem_cache *cache;   /* Owning cache. */
+    size_t free_cnt;            /* Number of free slots. */
+    void *free;                 /* First free slot. */
+    struct list_elem elem;      /* Element in cache's partial list. */
+  };
+
+/* All caches, for kmem_print_stats(). */
+static struct list cache_list;
+static struct lock cache_list_lock;
+
+static struct slab *slab_create (struct kmem_cache *);
+static struct slab *obj_to_slab (struct kmem_cache *, void *);
+static void **obj_link (struct kmem_cache *, void *);
+
+/* Initializes the object cache allocator. */
+void
+slab_init (void)
+{
+  list_init (&cache_list);
+  lock_init (&cache_list_lock);
+}
+
+/* Creates and returns a cache of SIZE-byte objects called NAME.
+   If CTOR is non-null it is run on each object when its slab is
+   created.  Returns a null pointer if memory is not available.
+   SIZE must leave room for at least one object in a page. */
+struct kmem_cache *
+kmem_cache_create (const char *name, size_t size, kmem_ctor_func *ctor)
+{
+  struct kmem_cache *c;
+
+  ASSERT (name != NULL);
+  ASSERT (size > 0);
+
+  c = malloc (sizeof *c);
+  if (c == NULL)
+    return NULL;
+
+  strlcpy (c->name, name, sizeof c->name);
+  c->obj_size = size;
+  if (ctor != NULL)
+    {
+      c->link_ofs = ROUND_UP (size, sizeof (void *));
+      c->slot_size = c->link_ofs + sizeof (void *);
+    }
+  else
+    {
+      c->link_ofs = 0;
+      c->slot_size = ROUND_UP (size < sizeof (void *) ? sizeof (void *) : size,
+                               sizeof (void *));
+    }
+  c->objs_per_slab = (PGSIZE - sizeof (struct slab)) / c->slot_size;
+  ASSERT (c->objs_per_slab > 0);
+  c->ctor = ctor;
+  list_init (&c->partial);
+  c->empty_cnt = 0;
+  lock_init (&c->lock);
+  lock_set_name (&c->lock, c->name);
+
+  c->slab_cnt = c->peak_slab_cnt = 0;
+  c->in_use = c->peak_in_use = 0;
+  c->alloc_cnt = c->ctor_cnt = 0;
+
+  lock_acquire (&cache_list_lock);
+  list_push_back (&cache_list, &c->elem);
+  lock_release (&cache_list_lock);
+
+  return c;
+}
+
+/* Obtains and returns an object from cache C.
+   Returns a null pointer if memory is not available. */
+void *
+kmem_cache_alloc (struct kmem_cache *c)
+{
+  struct slab *s;
+  void *obj;
+
+  ASSERT (c != NULL);
+
+  lock_acquire (&c->lock);
+
+  /* If no slab has a free slot, create a new one. */
+  if (list_empty (&c->partial))
+    {
+      s = slab_create (c);
+      if (s == NULL)
+        {
+          lock_release (&c->lock);
+          return NULL;
+        }
+      list_push_back (&c->partial, &s->elem);
+      c->empty_cnt++;
+    }
+
+  /* Take a slot from the first slab with free slots. */
+  s = list_entry (list_front (&c->partial), struct slab, elem);
+  if (s->free_cnt == c->objs_per_slab)
+    c->empty_cnt--;
+  obj = s->free;
+  s->free = *obj_link (c, obj);
+  if (--s->free_cnt == 0)
+    list_remove (&s->elem);
+
+  c->alloc_cnt++;
+  if (++c->in_use > c->peak_in_use)
+    c->peak_in_use = c->in_use;
+  lock_release (&c->lock);
+
+  return obj;
+}
+
+/* Returns OBJ, which must have been obtained from cache C with
+   kmem_cache_alloc(), to C.  A null OBJ is ignored. */
+void
+kmem_cache_free (struct kmem_cache *c, void *obj)
+{
+  struct slab *s;
+
+  if (obj == NULL)
+    return;
+
+  s = obj_to_slab (c, obj);
+
+#ifndef NDEBUG
+  /* Clear the object to help detect use-after-free bugs.  An
+     object with a constructor must keep its contents. */
+  if (c->ctor == NULL)
+    memset (obj, 0xcc, c->obj_size);
+#endif
+
+  lock_acquire (&c->lock);
+
+  *obj_link (c, obj) = s->free;
+  s->free = obj;
+  if (++s->free_cnt == 1)
+    list_push_front (&c->partial, &s->elem);
+  c->in_use--;
+
+  if (s->free_cnt == c->objs_per_slab)
+    {
+      list_remove (&s->elem);
+      if (c->empty_cnt > 0)
+        {
+          /* 已经有一个空闲的slab了，把这一页还给页分配器。 */
+          s->magic = 0;
+          palloc_free_page (s);
+          c->slab_cnt--;
+        }
+      else
+        {
+          list_push_back (&c->partial, &s->elem);
+          c->empty_cnt++;
+        }
+    }
+
+  lock_release (&c->lock);
+}
+
+/* Prints memory usage of each object cache. */
+void
+kmem_print_stats (void)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&cache_list); e != list_end (&cache_list);
+       e = list_next (e))
+    {
+      struct kmem_cache *c = list_entry (e, struct kmem_cache, elem);
+      printf ("Slab %s: %zu-byte objects, %zu in use (peak %zu), "
+              "%zu pages (peak %zu), %llu allocs, %llu ctor calls\n",
+              c->name, c->obj_size, c->in_use, c->peak_in_use,
+              c->slab_cnt, c->peak_slab_cnt, c->alloc_cnt, c->ctor_cnt);
+    }
+}
+
+/* 为缓存C分配一个新的slab并构造其中所有的对象。
+   返回时slab还不在C的partial链表中。必须持有C的锁。 */
+static struct slab *
+slab_create (struct kmem_cache *c)
+{
+  struct slab *s;
+  uint8_t *obj;
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&c->lock));
+
+  s = palloc_get_page (0);
+  if (s == NULL)
+    return NULL;
+
+  s->magic = SLAB_MAGIC;
+  s->cache = c;
+  s->free_cnt = c->objs_per_slab;
+  s->free = NULL;
+
+  /* 倒序把槽放入空闲链表，这样分配按地址从低到高进行。 */
+  for (i = c->objs_per_slab; i-- > 0; )
+    {
+      obj = (uint8_t *) (s + 1) + i * c->slot_size;
+      if (c->ctor != NULL)
+        {
+          c->ctor (obj);
+          c->ctor_cnt++;
+        }
+      *obj_link (c, obj) = s->free;
+      s->free = obj;
+    }
+
+  if (++c->slab_cnt > c->peak_slab_cnt)
+    c->peak_slab_cnt = c->slab_cnt;
+  return s;
+}
+
+/* 返回缓存C中对象OBJ所在的slab，并检查其有效性。 */
+static struct slab *
+obj_to_slab (struct kmem_cache *c, void *obj)
+{
+  struct slab *s = pg_round_down (obj);
+
+  ASSERT (s != NULL);
+  ASSERT (s->magic == SLAB_MAGIC);
+  ASSERT (s->cache == c);
+  ASSERT ((pg_ofs (obj) - sizeof *s) % c->slot_size == 0);
+
+  return s;
+}
+
+/* 返回空闲对象OBJ中存放空闲链表指针的位置。 */
+static void **
+obj_link (struct kmem_cache *c, void *obj)
+{
+  return (void **) ((uint8_t *) obj + c->link_ofs);
+}
@@ -29,18 +29,66 @@
 #include "threads/synch.h"
 #include <stdio.h>
 #include <string.h>
+#include "devices/timer.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 
-/* 比较优先级函数 */
+/* If true, record struct lock_stat for every lock.
+   Controlled by kernel command-line option "-lockstat". */
+bool lock_stat_enabled;
+
+/* 优先级捐赠沿等待链传递的最大层数。 */
+#define DONATE_DEPTH_MAX 8
+
+/* 所有有名字的锁，用于输出统计信息。 */
+static struct list lock_stat_list = LIST_INITIALIZER (lock_stat_list);
+
+/* 没有名字的锁的统计汇总。 */
+static struct lock_stat unnamed_lock_stat;
+
+/* 比较优先级函数，优先级高的排在前面。等待队列按此有序，
+   优先级相同的线程保持先来先服务。 */
 static bool
-priority_less (const struct list_elem *a_, const struct list_elem *b_,
-            void *aux UNUSED)
+priority_greater (const struct list_elem *a_, const struct list_elem *b_,
+                  void *aux UNUSED)
 {
   const struct thread *a = list_entry (a_, struct thread, elem);
   const struct thread *b = list_entry (b_, struct thread, elem);
 
-  return a->priority < b->priority;
+  return a->priority > b->priority;
+}
+
+/* 比较条件变量的两个等待者，等待线程优先级高的排在前面。 */
+static bool
+cond_waiter_greater (const struct list_elem *a_, const struct list_elem *b_,
+                     void *aux UNUSED)
+{
+  const struct semaphore_elem *a = list_entry (a_, struct semaphore_elem, elem);
+  const struct semaphore_elem *b = list_entry (b_, struct semaphore_elem, elem);
+
+  return a->thread->priority > b->thread->priority;
+}
+
+/* 线程T的优先级改变后，调整它在所等待的信号量和条件变量的等待队列
+   中的位置，保持等待队列按优先级有序。必须在关中断的情况下调用。 */
+void
+sema_priority_changed (struct thread *t)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (t->wait_sema != NULL)
+    {
+      list_remove (&t->elem);
+      list_insert_ordered (&t->wait_sema->waiters, &t->elem,
+                           priority_greater, NULL);
+    }
+  if (t->wait_cond_elem != NULL)
+    {
+      struct semaphore_elem *waiter = t->wait_cond_elem;
+      list_remove (&waiter->elem);
+      list_insert_ordered (&waiter->cond->waiters, &waiter->elem,
+                           cond_waiter_greater, NULL);
+    }
 }
 
 /* Initializes semaphore SEMA to VALUE.  A semaphore is a
@@ -79,7 +127,11 @@ sema_down (struct semaphore *sema)
   old_level = intr_disable ();
   while (sema->value == 0) 
     {
-      list_push_back (&sema->waiters, &thread_current ()->elem);
+      /* 按优先级有序插入，sema_up()只需取队首。 */
+      struct thread *cur = thread_current ();
+      list_insert_ordered (&sema->waiters, &cur->elem,
+                           priority_greater, NULL);
+      cur->wait_sema = sema;
       thread_block ();
     }
   sema->value--;
@@ -126,17 +178,21 @@ sema_up (struct semaphore *sema)
   old_level = intr_disable ();
   if (!list_empty (&sema->waiters))
     {
-      /* 唤醒优先级最高的线程 */
-      struct list_elem *max_elem = list_max (&sema->waiters, priority_less, NULL);
-      list_remove (max_elem);
-      thread_unblock (list_entry (max_elem, struct thread, elem));
+      /* 唤醒优先级最高的线程，即队首的线程 */
+      struct thread *t = list_entry (list_pop_front (&sema->waiters),
+                                     struct thread, elem);
+      t->wait_sema = NULL;
+      thread_unblock (t);
     }
 
   sema->value++;
   intr_set_level (old_level);
 
-  /* 线程调度 */
-  thread_yield ();
+  /* 线程调度，在中断处理程序中则在中断返回前调度。 */
+  if (intr_context ())
+    intr_yield_on_return ();
+  else
+    thread_yield ();
 }
 
 static void sema_test_helper (void *sema_);
@@ -198,30 +254,97 @@ lock_init (struct lock *lock)
 
   lock->holder = NULL;
   sema_init (&lock->semaphore, 1);
+  lock->max_priority = PRI_MIN - 1;
+  lock->name = NULL;
+  memset (&lock->stat, 0, sizeof lock->stat);
+  lock->acquire_time = 0;
 }
 
-/* 递归进行优先级捐赠 */
-void donate_chain (struct list *acquire_lock_list)
+/* Names LOCK as NAME and lists it separately in
+   lock_print_stats().  NAME must stay valid, and LOCK must not
+   be destroyed, until the system shuts down, so this is meant
+   for long-lived locks such as those in static or global
+   structures. */
+void
+lock_set_name (struct lock *lock, const char *name)
 {
-  struct list_elem *e;
+  enum intr_level old_level;
+
+  ASSERT (lock != NULL);
+  ASSERT (name != NULL);
+  ASSERT (lock->name == NULL);
+
+  old_level = intr_disable ();
+  lock->name = name;
+  list_push_back (&lock_stat_list, &lock->stat_elem);
+  intr_set_level (old_level);
+}
 
-  if (!list_empty(acquire_lock_list))
+/* 返回记录LOCK统计信息的结构，没有名字的锁汇总到一起。 */
+static struct lock_stat *
+lock_get_stat (struct lock *lock)
+{
+  return lock->name != NULL ? &lock->stat : &unnamed_lock_stat;
+}
+
+/* 当前线程获得LOCK后记录统计信息，WAIT_START为开始请求锁时的ticks。
+   必须在关中断的情况下调用。 */
+static void
+lock_stat_acquired (struct lock *lock, int64_t wait_start, bool contended)
+{
+  struct lock_stat *stat = lock_get_stat (lock);
+  int64_t now = timer_ticks ();
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  stat->acquire_cnt++;
+  if (contended)
     {
-      /* 遍历所有请求锁列表，查找请求锁中，锁持有者小于当前进程的进程，
-       * 进行优先级级联捐赠。 */
-      for(e = list_begin(acquire_lock_list);
-          e != list_end(acquire_lock_list);
-          e = list_next(e))
-        {
-          struct lock *l =
-              list_entry (e, struct lock, acquire_elem);
-          if (l->holder != NULL)
-            {
-              thread_update_priority_with_thread(l->holder,
-                  thread_get_priority());
-              donate_chain (&l->holder->acquire_lock_list);
-            }
-        }
+      int64_t wait = now - wait_start;
+      stat->contended_cnt++;
+      stat->wait_ticks += wait;
+      if (wait > stat->max_wait_ticks)
+        stat->max_wait_ticks = wait;
+    }
+  lock->acquire_time = now;
+}
+
+/* 返回LOCK的等待者中最高的优先级，没有等待者时为PRI_MIN - 1。
+   只在新的持有者获得锁时调用，其它时候使用缓存的max_priority。 */
+static int
+lock_max_waiter_priority (struct lock *lock)
+{
+  struct list *waiters = &lock->semaphore.waiters;
+
+  if (list_empty (waiters))
+    return PRI_MIN - 1;
+  return list_entry (list_front (waiters), struct thread, elem)->priority;
+}
+
+/* 沿着等待锁的链进行优先级捐赠：LOCK的等待者的优先级升为PRIORITY，
+ * 锁的持有者如果优先级较低，则被捐赠为PRIORITY，若持有者自己也在等待
+ * 另一个锁，继续向下捐赠，最多DONATE_DEPTH_MAX层。
+ * 持有者优先级不低于PRIORITY时，它之后的链已经得到了不低于PRIORITY的
+ * 捐赠，可以停止。必须在关中断的情况下调用。 */
+static void
+donate_chain (struct lock *lock, int priority)
+{
+  int depth;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (depth = 0; lock != NULL && depth < DONATE_DEPTH_MAX; depth++)
+    {
+      struct thread *holder = lock->holder;
+
+      if (lock->max_priority < priority)
+        lock->max_priority = priority;
+
+      if (holder == NULL || holder->priority >= priority)
+        break;
+      thread_update_priority_with_thread (holder, priority);
+      holder->is_donee = true;
+      lock = holder->wait_lock;
     }
 }
 
@@ -237,26 +360,27 @@ void
 lock_acquire (struct lock *lock)
 {
   enum intr_level old_level;
+  int64_t wait_start = 0;
+  bool contended;
+  struct thread *cur = thread_current ();
 
   ASSERT (lock != NULL);
   ASSERT (!intr_context ());
   ASSERT (!lock_held_by_current_thread (lock));
 
-  old_level = intr_disable ();
+  if (lock_stat_enabled)
+    wait_start = timer_ticks ();
 
-  /* 将当前进程请求的锁放入请求锁列表中。 */
-  list_push_back (&thread_current()->acquire_lock_list, &lock->acquire_elem);
+  old_level = intr_disable ();
+  contended = lock->holder != NULL;
 
-  /* 如果当前线程不是锁的持有者，并且当前线程的优先级比锁的持有者优先级高，
-   * 则将当前优先级捐献给锁的持有者。 */
-  if (lock->holder != NULL
-      && thread_get_priority () > lock->holder->priority)
+  /* 记录当前线程正在等待的锁，并沿着等待链进行优先级捐赠。
+   * mlfqs调度时优先级由调度器计算，不进行捐赠。 */
+  if (contended)
     {
-      thread_update_priority_with_thread (lock->holder,
-          thread_get_priority ());
-      lock->holder->is_donee = true;
-
-      donate_chain (&(lock->holder->acquire_lock_list));
+      cur->wait_lock = lock;
+      if (!thread_mlfqs)
+        donate_chain (lock, cur->priority);
     }
 
   intr_set_level (old_level);
@@ -265,13 +389,17 @@ lock_acquire (struct lock *lock)
   sema_down (&lock->semaphore);
 
   old_level = intr_disable ();
-  lock->holder = thread_current ();
+  lock->holder = cur;
+  cur->wait_lock = NULL;
 
-  /* 更新进程请求锁 */
-  list_remove (&lock->acquire_elem);
+  /* 当前线程不再是等待者，重新计算等待者的最高优先级。 */
+  lock->max_priority = lock_max_waiter_priority (lock);
 
   /* 更新线程持有的锁 */
-  list_push_back (&thread_current ()->hold_lock_list, &lock->elem);
+  list_push_back (&cur->hold_lock_list, &lock->elem);
+
+  if (lock_stat_enabled)
+    lock_stat_acquired (lock, wait_start, contended);
 
   intr_set_level (old_level);
 }
@@ -292,35 +420,34 @@ lock_try_acquire (struct lock *lock)
 
   success = sema_try_down (&lock->semaphore);
   if (success)
-    lock->holder = thread_current ();
+    {
+      enum intr_level old_level = intr_disable ();
+
+      lock->holder = thread_current ();
+      lock->max_priority = lock_max_waiter_priority (lock);
+      list_push_back (&thread_current ()->hold_lock_list, &lock->elem);
+      if (lock_stat_enabled)
+        lock_stat_acquired (lock, 0, false);
+      intr_set_level (old_level);
+    }
   return success;
 }
 
-/* 从一个进程持有锁链表中寻找优先级最大的进程的优先级值。 */
-int
+/* 从一个进程持有锁链表中寻找等待者的最高优先级，没有等待者时返回
+   PRI_MIN - 1。使用每个锁缓存的max_priority，只需遍历持有的锁。 */
+static int
 get_max_priority_thread (struct list *thread_hold_lock_list)
 {
   struct list_elem *e;
-  int max_priority = PRI_MIN;
+  int max_priority = PRI_MIN - 1;
 
-  /* 寻找该线程所持有的所有锁，找到锁的等待队列中优先级最大的进程的优先级 */
   for (e = list_begin (thread_hold_lock_list);
         e != list_end (thread_hold_lock_list);
         e = list_next (e))
     {
-      struct lock *l =
-          list_entry (e, struct lock, elem);
-      if (!list_empty (&(l->semaphore.waiters)))
-        {
-          struct list_elem *thread_elem =
-              list_max (&(l->semaphore.waiters), priority_less, NULL);
-          struct thread *thread =
-              list_entry (thread_elem, struct thread, elem);
-          if (thread->priority > max_priority)
-            {
-              max_priority = thread->priority;
-            }
-        }
+      struct lock *l = list_entry (e, struct lock, elem);
+      if (l->max_priority > max_priority)
+        max_priority = l->max_priority;
     }
 
   return max_priority;
@@ -335,50 +462,35 @@ void
 lock_release (struct lock *lock) 
 {
   enum intr_level old_level;
+  struct thread *cur = thread_current ();
   int max_priority;
 
   ASSERT (lock != NULL);
   ASSERT (lock_held_by_current_thread (lock));
 
   old_level = intr_disable ();
+  if (lock_stat_enabled)
+    lock_get_stat (lock)->hold_ticks += timer_ticks () - lock->acquire_time;
+
   /* 将这个锁从当前进程的hold_lock_list移除 */
   list_remove (&lock->elem);
 
   lock->holder = NULL;
 
-  /* 判断当前进程还持有锁的链表是否为空 */
-  if (!list_empty (&thread_current ()->hold_lock_list))
+  /* 当前进程的优先级为最原始的优先级与仍持有的锁的等待者最高优先级中
+   * 的较大者，后者较大时仍是被捐赠者。 */
+  if (!thread_mlfqs)
     {
-      max_priority =
-          get_max_priority_thread (&thread_current ()->hold_lock_list);
-      /* 如果当前进程优先级小于持有锁队列中进程的最大优先级，则进行被捐赠，将
-       * 优先级设置为该最大值。 */
-      if (thread_current ()->priority < max_priority)
-        {
-          thread_update_priority_with_thread (thread_current (),
-              max_priority);
-          thread_current ()->is_donee = true;
-        }
-      else
+      max_priority = get_max_priority_thread (&cur->hold_lock_list);
+      if (max_priority > cur->ori_pri)
         {
-          /* 如果当前进程处有被捐助优先级状态，并且当前优先级大于持有锁的队列中
-           * 进程的优先级，则将当前进程的优先级设置为持有锁队列中最大优先级。*/
-          if (thread_current ()->is_donee)
-            {
-              thread_update_priority_with_thread (thread_current (),
-                  max_priority);
-            }
+          thread_update_priority_with_thread (cur, max_priority);
+          cur->is_donee = true;
         }
-    }
-  else
-    {
-      /* 如果当前进程为被捐赠优先级进程，并且所持有的锁个数为0时，
-       * 恢复该进程最原始的优先级。 */
-      if (thread_current ()->is_donee)
+      else if (cur->is_donee)
         {
-          thread_update_priority_with_thread (thread_current (),
-              thread_current ()->ori_pri);
-          thread_current ()->is_donee = false;
+          thread_update_priority_with_thread (cur, cur->ori_pri);
+          cur->is_donee = false;
         }
     }
 
@@ -397,6 +509,34 @@ lock_held_by_current_thread (const struct lock *lock)
 
   return lock->holder == thread_current ();
 }
+
+/* 输出一个锁的统计信息。 */
+static void
+print_lock_stat (const char *name, const struct lock_stat *stat)
+{
+  printf ("Lock %s: %u acquires, %u contended, "
+          "%lld wait ticks (max %lld), %lld hold ticks\n",
+          name, stat->acquire_cnt, stat->contended_cnt,
+          stat->wait_ticks, stat->max_wait_ticks, stat->hold_ticks);
+}
+
+/* Prints lock statistics, if "-lockstat" was given. */
+void
+lock_print_stats (void)
+{
+  struct list_elem *e;
+
+  if (!lock_stat_enabled)
+    return;
+
+  for (e = list_begin (&lock_stat_list); e != list_end (&lock_stat_list);
+       e = list_next (e))
+    {
+      struct lock *l = list_entry (e, struct lock, stat_elem);
+      print_lock_stat (l->name, &l->stat);
+    }
+  print_lock_stat ("(unnamed)", &unnamed_lock_stat);
+}
 
 
 /* Initializes condition variable COND.  A condition variable
@@ -434,6 +574,8 @@ void
 cond_wait (struct condition *cond, struct lock *lock) 
 {
   struct semaphore_elem waiter;
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
 
   ASSERT (cond != NULL);
   ASSERT (lock != NULL);
@@ -441,7 +583,17 @@ cond_wait (struct condition *cond, struct lock *lock)
   ASSERT (lock_held_by_current_thread (lock));
   
   sema_init (&waiter.semaphore, 0);
-  list_push_back (&cond->waiters, &waiter.elem);
+  waiter.thread = cur;
+  waiter.cond = cond;
+
+  /* 等待队列按等待线程的优先级有序。优先级捐赠可能在持有LOCK以外的
+     时候调整等待队列，因此需要关中断。 */
+  old_level = intr_disable ();
+  list_insert_ordered (&cond->waiters, &waiter.elem,
+                       cond_waiter_greater, NULL);
+  cur->wait_cond_elem = &waiter;
+  intr_set_level (old_level);
+
   lock_release (lock);
   sema_down (&waiter.semaphore);
   lock_acquire (lock);
@@ -462,38 +614,17 @@ cond_signal (struct condition *cond, struct lock *lock UNUSED)
   ASSERT (!intr_context ());
   ASSERT (lock_held_by_current_thread (lock));
 
-  struct list_elem *max_cond_wait_elem;
-  struct semaphore *max_sema;
-  int max_priority = -1;
-
   if (!list_empty (&cond->waiters)) 
     {
-      /* 唤醒优先级最高的线程 */
-      struct list_elem *e;
-      for (e = list_begin (&cond->waiters);
-          e != list_end (&cond->waiters);
-          e = list_next (e))
-        {
-          struct semaphore_elem *semaphore_elem = list_entry (e,
-              struct semaphore_elem, elem);
-          if (!list_empty(&(semaphore_elem->semaphore.waiters)))
-            {
-              struct list_elem *max_elem =
-                  list_max (&(semaphore_elem->semaphore.waiters),
-                      priority_less, NULL);
-
-              struct thread *thread =
-                  list_entry (max_elem, struct thread, elem);
-              if (thread->priority > max_priority)
-                {
-                  max_priority = thread->priority;
-                  max_cond_wait_elem = e;
-                  max_sema = &semaphore_elem->semaphore;
-                }
-            }
-        }
-      list_remove (max_cond_wait_elem);
-      sema_up (max_sema);
+      /* 唤醒优先级最高的线程，即队首的等待者 */
+      enum intr_level old_level = intr_disable ();
+      struct semaphore_elem *waiter =
+          list_entry (list_pop_front (&cond->waiters),
+                      struct semaphore_elem, elem);
+      waiter->thread->wait_cond_elem = NULL;
+      intr_set_level (old_level);
+
+      sema_up (&waiter->semaphore);
     }
 }
 
@@ -512,3 +643,139 @@ cond_broadcast (struct condition *cond, struct lock *lock)
   while (!list_empty (&cond->waiters))
     cond_signal (cond, lock);
 }
+
+/* Initializes RWLOCK as unheld. */
+void
+rwlock_init (struct rwlock *rwlock)
+{
+  ASSERT (rwlock != NULL);
+
+  lock_init (&rwlock->write_lock);
+  lock_init (&rwlock->lock);
+  cond_init (&rwlock->no_readers);
+  rwlock->readers = 0;
+}
+
+/* Acquires RWLOCK for reading, sleeping while a writer holds it
+   or is waiting for it.  Readers pass through WRITE_LOCK on the
+   way in, so they queue behind writers in priority order and
+   donate their priority to the writer that holds it.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_read (struct rwlock *rwlock)
+{
+  ASSERT (rwlock != NULL);
+
+  lock_acquire (&rwlock->write_lock);
+  lock_acquire (&rwlock->lock);
+  rwlock->readers++;
+  lock_release (&rwlock->lock);
+  lock_release (&rwlock->write_lock);
+}
+
+/* Releases RWLOCK, which the current thread must hold for
+   reading.  The last reader out wakes up a waiting writer. */
+void
+rwlock_release_read (struct rwlock *rwlock)
+{
+  ASSERT (rwlock != NULL);
+
+  lock_acquire (&rwlock->lock);
+  ASSERT (rwlock->readers > 0);
+  if (--rwlock->readers == 0)
+    cond_signal (&rwlock->no_readers, &rwlock->lock);
+  lock_release (&rwlock->lock);
+}
+
+/* Acquires RWLOCK for writing, sleeping until no other writer
+   holds it and all current readers have left.  New readers are
+   kept out from the moment we get WRITE_LOCK, so a writer waits
+   at most for the readers that were already inside.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_write (struct rwlock *rwlock)
+{
+  ASSERT (rwlock != NULL);
+
+  lock_acquire (&rwlock->write_lock);
+  lock_acquire (&rwlock->lock);
+  while (rwlock->readers > 0)
+    cond_wait (&rwlock->no_readers, &rwlock->lock);
+  lock_release (&rwlock->lock);
+}
+
+/* Releases RWLOCK, which the current thread must hold for
+   writing. */
+void
+rwlock_release_write (struct rwlock *rwlock)
+{
+  ASSERT (rwlock != NULL);
+  ASSERT (rwlock_held_for_write (rwlock));
+
+  lock_release (&rwlock->write_lock);
+}
+
+/* Returns true if the current thread holds RWLOCK for writing,
+   false otherwise. */
+bool
+rwlock_held_for_write (const struct rwlock *rwlock)
+{
+  ASSERT (rwlock != NULL);
+
+  return lock_held_by_current_thread (&rwlock->write_lock);
+}
+
+/* Initializes SEQLOCK. */
+void
+seqlock_init (struct seqlock *seqlock)
+{
+  ASSERT (seqlock != NULL);
+
+  seqlock->sequence = 0;
+}
+
+/* Begins a read of the data protected by SEQLOCK and returns a
+   value to pass to seqlock_read_retry() once the data has been
+   copied out.  May be called from an interrupt handler. */
+unsigned
+seqlock_read_begin (const struct seqlock *seqlock)
+{
+  unsigned start = seqlock->sequence;
+  barrier ();
+  return start;
+}
+
+/* Returns true if the data read since seqlock_read_begin()
+   returned START may be inconsistent, because a write was in
+   progress or has happened since, in which case the read must
+   be repeated. */
+bool
+seqlock_read_retry (const struct seqlock *seqlock, unsigned start)
+{
+  barrier ();
+  return (start & 1) != 0 || seqlock->sequence != start;
+}
+
+/* Begins a write to the data protected by SEQLOCK. */
+void
+seqlock_write_begin (struct seqlock *seqlock)
+{
+  ASSERT ((seqlock->sequence & 1) == 0);
+
+  seqlock->sequence++;
+  barrier ();
+}
+
+/* Ends a write to the data protected by SEQLOCK. */
+void
+seqlock_write_end (struct seqlock *seqlock)
+{
+  ASSERT ((seqlock->sequence & 1) != 0);
+
+  barrier ();
+  seqlock->sequence++;
+}
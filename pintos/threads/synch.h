@@ -3,12 +3,16 @@
 
 #include <list.h>
 #include <stdbool.h>
+#include <stdint.h>
+
+struct thread;
 
 /* A counting semaphore. */
 struct semaphore 
   {
     unsigned value;             /* Current value. */
-    struct list waiters;        /* List of waiting threads. */
+    struct list waiters;        /* List of waiting threads, highest
+                                   priority first. */
   };
 
 void sema_init (struct semaphore *, unsigned value);
@@ -16,6 +20,17 @@ void sema_down (struct semaphore *);
 bool sema_try_down (struct semaphore *);
 void sema_up (struct semaphore *);
 void sema_self_test (void);
+void sema_priority_changed (struct thread *);
+
+/* 锁的竞争统计，"-lockstat"选项打开时记录。 */
+struct lock_stat
+  {
+    unsigned acquire_cnt;               /* 获得锁的次数 */
+    unsigned contended_cnt;             /* 获得锁时需要等待的次数 */
+    int64_t wait_ticks;                 /* 等待锁的总ticks */
+    int64_t max_wait_ticks;             /* 单次等待锁的最长ticks */
+    int64_t hold_ticks;                 /* 持有锁的总ticks */
+  };
 
 /* Lock. */
 struct lock 
@@ -24,19 +39,31 @@ struct lock
     struct semaphore semaphore;         /* Binary semaphore controlling access. */
 
     struct list_elem elem;              /* 用于hold_lock_list element. */
-    struct list_elem acquire_elem;      /* 用于acquire_lock_list element */
+    int max_priority;                   /* 等待者的最高优先级（缓存） */
+
+    const char *name;                   /* 锁的名字，为空时不单独统计 */
+    struct list_elem stat_elem;         /* 用于lock_stat_list element */
+    struct lock_stat stat;              /* 竞争统计 */
+    int64_t acquire_time;               /* 获得锁时的ticks */
   };
 
+/* If true, record struct lock_stat for every lock.
+   Controlled by kernel command-line option "-lockstat". */
+extern bool lock_stat_enabled;
+
 void lock_init (struct lock *);
+void lock_set_name (struct lock *, const char *name);
 void lock_acquire (struct lock *);
 bool lock_try_acquire (struct lock *);
 void lock_release (struct lock *);
 bool lock_held_by_current_thread (const struct lock *);
+void lock_print_stats (void);
 
 /* Condition variable. */
 struct condition 
   {
-    struct list waiters;        /* List of waiting threads. */
+    struct list waiters;        /* List of waiting threads, highest
+                                   priority first. */
   };
 
 /* One semaphore in a list. */
@@ -44,6 +71,8 @@ struct semaphore_elem
   {
     struct list_elem elem;              /* List element. */
     struct semaphore semaphore;         /* This semaphore. */
+    struct thread *thread;              /* 等待的线程 */
+    struct condition *cond;             /* 所在的条件变量 */
   };
 
 void cond_init (struct condition *);
@@ -51,6 +80,42 @@ void cond_wait (struct condition *, struct lock *);
 void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
 
+/* Readers-writer lock.  Any number of readers may hold it at
+   once, or a single writer.  Writers are preferred: once a writer
+   is waiting, new readers wait behind it, and readers waiting on
+   an active or waiting writer donate their priority to it. */
+struct rwlock
+  {
+    struct lock write_lock;     /* 写者持有期间不允许新的读者进入 */
+    struct lock lock;           /* 保护readers */
+    struct condition no_readers; /* readers变为0时通知等待的写者 */
+    unsigned readers;           /* 持有读锁的线程数 */
+  };
+
+void rwlock_init (struct rwlock *);
+void rwlock_acquire_read (struct rwlock *);
+void rwlock_release_read (struct rwlock *);
+void rwlock_acquire_write (struct rwlock *);
+void rwlock_release_write (struct rwlock *);
+bool rwlock_held_for_write (const struct rwlock *);
+
+/* Sequence lock, for small read-mostly data.  Readers never
+   block: they read the data between seqlock_read_begin() and
+   seqlock_read_retry() and start over if a writer intervened.
+   Writers must be serialized by the caller, normally by running
+   with interrupts off, so readers never spin on a preempted
+   writer. */
+struct seqlock
+  {
+    unsigned sequence;          /* Odd while a write is in progress. */
+  };
+
+void seqlock_init (struct seqlock *);
+unsigned seqlock_read_begin (const struct seqlock *);
+bool seqlock_read_retry (const struct seqlock *, unsigned start);
+void seqlock_write_begin (struct seqlock *);
+void seqlock_write_end (struct seqlock *);
+
 /* Optimization barrier.
 
    The compiler will not reorder operations across an
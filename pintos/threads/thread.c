@@ -20,9 +20,14 @@
    of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
+/* Processes in THREAD_READY state, that is, processes that are
+   ready to run but not actually running.
+   就绪队列按优先级分为PRI_MAX + 1个FIFO队列，ready_bitmap的第i位
+   表示优先级为i的队列非空，选择下一个线程只需找到最高的置位。 */
+static struct list ready_queues[PRI_MAX + 1];
+static uint64_t ready_bitmap;
+static int ready_cnt;           /* 所有就绪队列中线程的总数。 */
+static unsigned ready_seq;      /* 入队序号，用于保持同优先级线程的先后顺序。 */
 
 /* List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
@@ -57,6 +62,19 @@ static long long user_ticks;    /* # of timer ticks in user programs. */
 
 static fixedpoint load_avg;     /* load_avg. */
 
+/* mlfqs中阻塞线程的recent_cpu延迟更新。
+   每秒只更新运行和就绪线程的recent_cpu，并把本秒的衰减系数
+   (2*load_avg)/(2*load_avg + 1)记录到decay_history中。阻塞线程记录
+   自己最后一次更新时的recent_cpu_epoch，在被唤醒时按历史系数逐秒补算，
+   结果与每秒更新所有线程完全相同。
+   lazy_list中的阻塞线程按recent_cpu_epoch从小到大排列，阻塞时间快要
+   超过历史记录长度的线程会提前补算，因此每秒只需处理链表头部。 */
+#define DECAY_HISTORY 64
+static fixedpoint decay_history[DECAY_HISTORY];
+static unsigned load_avg_epoch;   /* 已经过的load_avg更新次数（秒）。 */
+static unsigned priority_epoch;   /* 已经过的优先级更新次数（每4个ticks）。 */
+static struct list lazy_list;     /* 延迟更新recent_cpu的阻塞线程。 */
+
 /* Scheduling. */
 #define TIME_SLICE 4            /* # of timer ticks to give each thread. */
 static unsigned thread_ticks;   /* # of timer ticks since last yield. */
@@ -77,16 +95,72 @@ static void *alloc_frame (struct thread *, size_t size);
 static void schedule (void);
 void thread_schedule_tail (struct thread *prev);
 static tid_t allocate_tid (void);
+static void mlfqs_catch_up (struct thread *);
+
+/* 将线程T放到优先级为T->priority的就绪队列尾部。
+   必须在关中断的情况下调用。 */
+static void
+ready_queue_push (struct thread *t)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (PRI_MIN <= t->priority && t->priority <= PRI_MAX);
+
+  t->ready_seq = ready_seq++;
+  list_push_back (&ready_queues[t->priority], &t->elem);
+  ready_bitmap |= (uint64_t) 1 << t->priority;
+  ready_cnt++;
+}
+
+/* 将线程T从它所在的就绪队列中移除，队列变空时清除对应位。
+   T->priority必须仍是入队时的优先级。 */
+static void
+ready_queue_remove (struct thread *t)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  list_remove (&t->elem);
+  if (list_empty (&ready_queues[t->priority]))
+    ready_bitmap &= ~((uint64_t) 1 << t->priority);
+  ready_cnt--;
+}
 
-/* 比较优先级函数 */
+/* 按入队序号比较两个就绪线程。 */
 static bool
-value_less (const struct list_elem *a_, const struct list_elem *b_,
-            void *aux UNUSED)
+ready_seq_less (const struct list_elem *a_, const struct list_elem *b_,
+                void *aux UNUSED)
 {
   const struct thread *a = list_entry (a_, struct thread, elem);
   const struct thread *b = list_entry (b_, struct thread, elem);
 
-  return a->priority < b->priority;
+  return (int) (a->ready_seq - b->ready_seq) < 0;
+}
+
+/* 将就绪线程T移动到优先级为NEW_PRIORITY的就绪队列。T在新队列中按
+   原来的入队序号排列，与所有就绪线程放在一个链表中时的先后顺序相同。 */
+static void
+ready_queue_move (struct thread *t, int new_priority)
+{
+  ready_queue_remove (t);
+  t->priority = new_priority;
+  list_insert_ordered (&ready_queues[new_priority], &t->elem,
+                       ready_seq_less, NULL);
+  ready_bitmap |= (uint64_t) 1 << new_priority;
+  ready_cnt++;
+}
+
+/* 返回就绪队列中最高的优先级，就绪队列为空时返回-1。 */
+static int
+ready_queue_max_priority (void)
+{
+  uint32_t high = ready_bitmap >> 32;
+  uint32_t low = ready_bitmap;
+
+  if (high != 0)
+    return 63 - __builtin_clz (high);
+  else if (low != 0)
+    return 31 - __builtin_clz (low);
+  else
+    return -1;
 }
 
 bool
@@ -111,11 +185,18 @@ thread_is_idle()
 void
 thread_init (void) 
 {
+  int i;
+
   ASSERT (intr_get_level () == INTR_OFF);
 
   lock_init (&tid_lock);
-  list_init (&ready_list);
+  lock_set_name (&tid_lock, "tid");
+  for (i = PRI_MIN; i <= PRI_MAX; i++)
+    list_init (&ready_queues[i]);
+  ready_bitmap = 0;
+  ready_cnt = 0;
   list_init (&all_list);
+  list_init (&lazy_list);
 
   /* Set up a thread structure for the running thread. */
   initial_thread = running_thread ();
@@ -178,6 +259,13 @@ thread_print_stats (void)
           idle_ticks, kernel_ticks, user_ticks);
 }
 
+/* Returns the number of timer ticks spent idle so far. */
+long long
+thread_idle_ticks (void)
+{
+  return idle_ticks;
+}
+
 /* Creates a new kernel thread named NAME with the given initial
    PRIORITY, which executes FUNCTION passing AUX as the argument,
    and adds it to the ready queue.  Returns the thread identifier
@@ -258,6 +346,17 @@ thread_block (void)
   ASSERT (!intr_context ());
   ASSERT (intr_get_level () == INTR_OFF);
 
+  /* 阻塞期间不再每秒更新recent_cpu，唤醒时再补算。
+     空闲线程不经过thread_unblock()被调度，不参与延迟更新。 */
+  if (thread_mlfqs && thread_current () != idle_thread)
+    {
+      struct thread *cur = thread_current ();
+      cur->recent_cpu_epoch = load_avg_epoch;
+      cur->priority_epoch = priority_epoch;
+      cur->is_lazy = true;
+      list_push_back (&lazy_list, &cur->lazyelem);
+    }
+
   thread_current ()->status = THREAD_BLOCKED;
   schedule ();
 }
@@ -280,8 +379,13 @@ thread_unblock (struct thread *t)
   old_level = intr_disable ();
   ASSERT (t->status == THREAD_BLOCKED);
 
+  /* 补算阻塞期间的recent_cpu和优先级，必须在放入就绪队列之前，
+     以便按最新的优先级入队。 */
+  if (thread_mlfqs)
+    mlfqs_catch_up (t);
+
   /* 放到就绪队列 */
-  list_push_back (&ready_list, &t->elem);
+  ready_queue_push (t);
   t->status = THREAD_READY;
   intr_set_level (old_level);
 }
@@ -329,6 +433,7 @@ thread_exit (void)
 #ifdef USERPROG
   process_exit ();
 #endif
+  palloc_drain_magazines ();
 
   /* Remove thread from all threads list, set our status to dying,
      and schedule another process.  That process will destroy us
@@ -353,7 +458,7 @@ thread_yield (void)
   old_level = intr_disable ();
   if (cur != idle_thread) 
     {
-      list_push_back (&ready_list, &cur->elem);
+      ready_queue_push (cur);
     }
 
   /* 标记当前线程为就绪状态，下一步schedule()将当前线程放入就绪队列，
@@ -411,9 +516,25 @@ void
 thread_update_priority_with_thread (struct thread *thread,
     int new_priority)
 {
+  enum intr_level old_level;
+
   ASSERT (thread != NULL)
+  ASSERT (PRI_MIN <= new_priority && new_priority <= PRI_MAX);
+
+  old_level = intr_disable ();
+  if (thread->priority != new_priority)
+    {
+      /* 就绪线程优先级改变时需要移动到新的优先级队列。
+         空闲线程yield时状态为就绪，但不在就绪队列中。 */
+      if (thread->status == THREAD_READY && thread != idle_thread)
+        ready_queue_move (thread, new_priority);
+      else
+        thread->priority = new_priority;
 
-  thread->priority = new_priority;
+      /* 在信号量或条件变量上等待的线程需要调整在等待队列中的位置。 */
+      sema_priority_changed (thread);
+    }
+  intr_set_level (old_level);
 }
 
 /* Returns the current thread's priority. */
@@ -464,9 +585,7 @@ thread_set_nice (int nice UNUSED)
   intr_set_level (oldlevle);
 
   /* If the running thread no longer has the highest priority, yields. */
-  struct list_elem *max_elem = list_max (&ready_list, value_less, NULL);
-  struct thread *thread = list_entry (max_elem, struct thread, elem);
-  if(thread_current ()->priority < thread->priority )
+  if (thread_current ()->priority < ready_queue_max_priority ())
     {
       thread_yield();
     }
@@ -492,9 +611,9 @@ thread_get_load_avg (void)
  * (1/60)*(2^14) = 273(fixedpoint).
  */
 void
-load_avg_update()
+load_avg_update (void)
 {
-  int ready_threads = list_size(&ready_list);
+  int ready_threads = ready_cnt;
 
   /*
   where ready threads is the number of threads that are either
@@ -521,11 +640,50 @@ thread_get_recent_cpu (void)
       fixedpoint_multiply_int(thread_current ()->recent_cpu, 100));
 }
 
-/* 更新进程recent_cpu。
+/* 将线程T的recent_cpu逐秒补算到当前的load_avg_epoch。
  * recent_cpu = (2*load_avg )/(2*load_avg + 1) * recent_cpu + nice
  * */
+static void
+recent_cpu_catch_up (struct thread *t)
+{
+  ASSERT (load_avg_epoch - t->recent_cpu_epoch <= DECAY_HISTORY);
+
+  while (t->recent_cpu_epoch != load_avg_epoch)
+    {
+      fixedpoint coef =
+          decay_history[t->recent_cpu_epoch % DECAY_HISTORY];
+      t->recent_cpu = fixedpoint_multiply (coef, t->recent_cpu)
+          + convert_int_to_fixedpoint (t->nice);
+      t->recent_cpu_epoch++;
+    }
+}
+
+/* 唤醒阻塞线程T前调用，补算阻塞期间错过的recent_cpu和优先级更新。
+ * 只有阻塞期间经过了优先级更新时刻时才重新计算优先级，否则保持
+ * 阻塞前的优先级，与每4个ticks更新所有线程的结果相同。 */
+static void
+mlfqs_catch_up (struct thread *t)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (t->is_lazy)
+    {
+      list_remove (&t->lazyelem);
+      t->is_lazy = false;
+    }
+  recent_cpu_catch_up (t);
+  if (t->priority_epoch != priority_epoch)
+    {
+      t->priority_epoch = priority_epoch;
+      thread_priority_update (t, NULL);
+    }
+}
+
+/* 每秒更新一次recent_cpu，在load_avg_update()之后调用。
+ * 只更新运行和就绪的线程；阻塞线程在唤醒时补算，阻塞时间即将超过
+ * DECAY_HISTORY秒的线程在这里提前补算。 */
 void
-thread_recent_cpu_update (struct thread *t, void *aux UNUSED)
+thread_recent_cpu_update (void)
 {
   /*
    * You may need to think about the order of calculations in this
@@ -537,10 +695,64 @@ thread_recent_cpu_update (struct thread *t, void *aux UNUSED)
   fixedpoint double_load_avg = fixedpoint_multiply_int (load_avg, 2);
   fixedpoint double_load_avg_plus_one =
       fixedpoint_add_int (double_load_avg, 1);
-  fixedpoint temp = fixedpoint_divide (double_load_avg,
-      double_load_avg_plus_one);
-  temp = fixedpoint_multiply (temp, t->recent_cpu);
-  t->recent_cpu = temp + convert_int_to_fixedpoint (t->nice);
+  struct thread *cur = running_thread ();
+  int pri;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  decay_history[load_avg_epoch % DECAY_HISTORY] =
+      fixedpoint_divide (double_load_avg, double_load_avg_plus_one);
+  load_avg_epoch++;
+
+  /* 运行和就绪线程。 */
+  if (cur != idle_thread)
+    recent_cpu_catch_up (cur);
+  for (pri = PRI_MIN; pri <= PRI_MAX; pri++)
+    {
+      struct list_elem *e;
+
+      for (e = list_begin (&ready_queues[pri]);
+           e != list_end (&ready_queues[pri]); e = list_next (e))
+        recent_cpu_catch_up (list_entry (e, struct thread, elem));
+    }
+
+  /* 下一秒将覆盖最早的历史系数，补算依赖它的阻塞线程，并移到
+     链表尾部以保持按recent_cpu_epoch排序。 */
+  while (!list_empty (&lazy_list))
+    {
+      struct thread *t = list_entry (list_front (&lazy_list),
+                                     struct thread, lazyelem);
+      if (load_avg_epoch - t->recent_cpu_epoch < DECAY_HISTORY)
+        break;
+      recent_cpu_catch_up (t);
+      list_push_back (&lazy_list, list_pop_front (&lazy_list));
+    }
+}
+
+/* 每4个ticks更新一次优先级，只更新运行和就绪的线程。
+ * 就绪线程的优先级改变时会移动到其它就绪队列，提前取得下一个元素；
+ * 移动到尚未遍历的队列的线程会被再次计算，结果不变。 */
+void
+thread_priority_update_active (void)
+{
+  int pri;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  priority_epoch++;
+  if (running_thread () != idle_thread)
+    thread_priority_update (running_thread (), NULL);
+  for (pri = PRI_MIN; pri <= PRI_MAX; pri++)
+    {
+      struct list_elem *e, *next;
+
+      for (e = list_begin (&ready_queues[pri]);
+           e != list_end (&ready_queues[pri]); e = next)
+        {
+          next = list_next (e);
+          thread_priority_update (list_entry (e, struct thread, elem), NULL);
+        }
+    }
 }
 
 /* Idle thread.  Executes when no other thread is ready to run.
@@ -666,8 +878,15 @@ init_thread (struct thread *t, const char *name, int priority)
   /* 初始化持有锁链表 */
   list_init (&t->hold_lock_list);
 
-  /* 初始化请求的锁链表 */
-  list_init (&t->acquire_lock_list);
+  /* 初始化正在等待的锁、信号量和条件变量 */
+  t->wait_lock = NULL;
+  t->wait_sema = NULL;
+  t->wait_cond_elem = NULL;
+
+  /* 新线程的recent_cpu是最新的，在第一次thread_unblock()时补算
+     创建期间可能错过的更新。 */
+  t->recent_cpu_epoch = load_avg_epoch;
+  t->priority_epoch = priority_epoch;
 
   t->magic = THREAD_MAGIC;
   list_push_back (&all_list, &t->allelem);
@@ -694,18 +913,20 @@ alloc_frame (struct thread *t, size_t size)
 static struct thread *
 next_thread_to_run (void) 
 {
-  if (list_empty (&ready_list))
+  int max_priority = ready_queue_max_priority ();
+
+  if (max_priority < 0)
     {
       return idle_thread;
     }
   else
     {
       /* 获取就绪队列中优先级最大的线程，从就绪队列中移除，返回该线程。
-       * 如果有多个优先级最大的线程，则选择最早放入就绪队列中的线程，
-       * 参见list_max函数注释。 */
-      struct list_elem *max_elem = list_max (&ready_list, value_less, NULL);
-      list_remove (max_elem);
-      return list_entry (max_elem, struct thread, elem);
+       * 如果有多个优先级最大的线程，则选择最早放入该优先级队列中的线程。 */
+      struct thread *t = list_entry (list_front (&ready_queues[max_priority]),
+                                     struct thread, elem);
+      ready_queue_remove (t);
+      return t;
     }
 }
 
@@ -2,9 +2,11 @@
 #define THREADS_THREAD_H
 
 #include <debug.h>
+#include <hash.h>
 #include <list.h>
 #include <stdint.h>
 #include "synch.h"
+#include "palloc.h"
 #include "fixed-point.h"
 
 /* States in a thread's life cycle. */
@@ -96,10 +98,18 @@ struct thread
     int ori_pri;                        /* 最原始的优先级 */
     bool is_donee;                      /* 是否是被捐赠优先级者 */
     struct list hold_lock_list;         /* 该线程持有锁的链表 */
-    struct list acquire_lock_list;      /* 请求的锁的链表 */
+    struct lock *wait_lock;             /* 正在等待的锁 */
+    struct semaphore *wait_sema;        /* 正在等待的信号量 */
+    struct semaphore_elem *wait_cond_elem; /* 在条件变量中的等待者 */
 
     fixedpoint recent_cpu;              /* recent_cpu */
     int nice;                           /* nice */
+    unsigned recent_cpu_epoch;          /* recent_cpu已更新到的秒数 */
+    unsigned priority_epoch;            /* 优先级已更新到的次数 */
+    bool is_lazy;                       /* 是否在延迟更新链表中 */
+    struct list_elem lazyelem;          /* 延迟更新链表element */
+    unsigned ready_seq;                 /* 放入就绪队列的序号 */
+    struct page_magazine page_magazines[2]; /* 内核池和用户池的空闲页缓存 */
 
     struct list_elem allelem;           /* List element for all threads list. */
 
@@ -111,6 +121,14 @@ struct thread
     uint32_t *pagedir;                  /* Page directory. */
 #endif
 
+#ifdef VM
+    /* Owned by vm/page.c. */
+    struct hash pages;                  /* Supplemental page table. */
+
+    /* Owned by userprog/process.c. */
+    struct file *exec_file;             /* 可执行文件，按需装入时读取 */
+#endif
+
     /* Owned by thread.c. */
     unsigned magic;                     /* Detects stack overflow. */
   };
@@ -125,6 +143,7 @@ void thread_start (void);
 
 void thread_tick (void);
 void thread_print_stats (void);
+long long thread_idle_ticks (void);
 
 typedef void thread_func (void *aux);
 tid_t thread_create (const char *name, int priority, thread_func *, void *);
@@ -146,11 +165,14 @@ void thread_foreach (thread_action_func *, void *);
 int thread_get_priority (void);
 void thread_set_priority (int);
 void thread_priority_update (struct thread *t, void *aux UNUSED);
+void thread_priority_update_active (void);
+void thread_update_priority_with_thread (struct thread *, int);
 
 int thread_get_nice (void);
 void thread_set_nice (int);
 int thread_get_recent_cpu (void);
-void thread_recent_cpu_update (struct thread *t, void *aux UNUSED);
+void thread_recent_cpu_update (void);
+void load_avg_update (void);
 int thread_get_load_avg (void);
 
 bool thread_is_idle();
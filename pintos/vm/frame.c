@@ -0,0 +1,92 @@
+#include "vm/frame.h"
+#include "vm/page.h"
+#include <debug.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "userprog/pagedir.h"
+
+/* Frame table: every user-pool page that holds a resident user
+   page, in the order the clock hand visits them.  Protected by
+   the page lock in vm/page.c, which callers must hold. */
+static struct list frames = LIST_INITIALIZER (frames);
+
+/* 时钟算法的指针，指向下一个要检查的页框。 */
+static struct list_elem *hand;
+
+static struct frame *evict (void);
+
+/* Returns a frame to hold PAGE for the current thread, taking a
+   free user-pool page if there is one and otherwise evicting the
+   least recently used page chosen by the clock algorithm.
+   Returns a null pointer if no frame can be freed.  The frame's
+   contents are undefined. */
+struct frame *
+frame_alloc (struct page *page)
+{
+  struct frame *f;
+  void *kpage = palloc_get_page (PAL_USER);
+
+  if (kpage != NULL)
+    {
+      f = malloc (sizeof *f);
+      if (f == NULL)
+        {
+          palloc_free_page (kpage);
+          return NULL;
+        }
+      f->kpage = kpage;
+      list_push_back (&frames, &f->elem);
+    }
+  else
+    {
+      f = evict ();
+      if (f == NULL)
+        return NULL;
+    }
+
+  f->page = page;
+  f->owner = thread_current ();
+  return f;
+}
+
+/* Removes F from the frame table and frees its page.  The page
+   must already be unmapped. */
+void
+frame_free (struct frame *f)
+{
+  if (hand == &f->elem)
+    hand = list_next (hand);
+  list_remove (&f->elem);
+  palloc_free_page (f->kpage);
+  free (f);
+}
+
+/* 用时钟算法选择一个页框并换出其中的页，返回该页框。
+   最近访问过的页清除访问位后跳过。两圈都找不到可换出的页时
+   返回NULL。 */
+static struct frame *
+evict (void)
+{
+  size_t n = list_size (&frames) * 2;
+
+  while (n-- > 0)
+    {
+      struct frame *f;
+      uint32_t *pd;
+
+      if (hand == NULL || hand == list_end (&frames))
+        hand = list_begin (&frames);
+      if (hand == list_end (&frames))
+        return NULL;
+      f = list_entry (hand, struct frame, elem);
+      hand = list_next (hand);
+
+      pd = f->owner->pagedir;
+      if (pagedir_is_accessed (pd, f->page->upage))
+        pagedir_set_accessed (pd, f->page->upage, false);
+      else if (page_out (f->page, pd))
+        return f;
+    }
+  return NULL;
+}
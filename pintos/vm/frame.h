@@ -0,0 +1,21 @@
+#ifndef VM_FRAME_H
+#define VM_FRAME_H
+
+#include <list.h>
+
+struct page;
+struct thread;
+
+/* A page of the user pool holding a resident user page. */
+struct frame
+  {
+    struct list_elem elem;      /* Element in frame table. */
+    void *kpage;                /* Kernel virtual address. */
+    struct page *page;          /* Page held. */
+    struct thread *owner;       /* Thread whose page it is. */
+  };
+
+struct frame *frame_alloc (struct page *);
+void frame_free (struct frame *);
+
+#endif /* vm/frame.h */
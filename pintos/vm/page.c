@@ -0,0 +1,368 @@
+#include "vm/page.h"
+#include <debug.h>
+#include <string.h>
+#include "vm/frame.h"
+#include "vm/swap.h"
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+
+/* Most bytes the user stack may grow to. */
+#define STACK_MAX (8 * 1024 * 1024)
+
+/* Serializes all paging: supplemental page tables, the frame
+   table and moving pages in and out of memory.  A fault thus
+   waits for any eviction in progress, including the eviction of
+   the page it faulted on. */
+static struct lock page_lock;
+
+static struct page *find_page (void *upage);
+static bool load_page (struct page *);
+static bool merge_file (struct page *, struct file *, off_t ofs,
+                        size_t read_bytes, bool writable);
+static hash_hash_func page_hash;
+static hash_less_func page_less;
+static hash_action_func destroy_page;
+
+/* Initializes the virtual memory system. */
+void
+page_init (void)
+{
+  lock_init (&page_lock);
+}
+
+/* Initializes the current thread's supplemental page table.
+   Returns true if successful, false if memory is short. */
+bool
+page_table_init (void)
+{
+  return hash_init (&thread_current ()->pages, page_hash, page_less, NULL);
+}
+
+/* Destroys the current thread's supplemental page table, freeing
+   the frames and swap slots its pages occupy.  Must be called
+   while the thread's page directory still exists. */
+void
+page_table_destroy (void)
+{
+  lock_acquire (&page_lock);
+  hash_destroy (&thread_current ()->pages, destroy_page);
+  lock_release (&page_lock);
+}
+
+/* 新建一个UPAGE处、类型为TYPE的页并加入当前线程的页表。
+   UPAGE已在页表中或内存不足时返回NULL。 */
+static struct page *
+add_page (void *upage, enum page_type type, bool writable)
+{
+  struct page *p;
+
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (is_user_vaddr (upage));
+
+  p = malloc (sizeof *p);
+  if (p == NULL)
+    return NULL;
+  p->upage = upage;
+  p->writable = writable;
+  p->type = type;
+  p->frame = NULL;
+  p->file = NULL;
+  p->file_ofs = 0;
+  p->read_bytes = 0;
+
+  if (hash_insert (&thread_current ()->pages, &p->hash_elem) != NULL)
+    {
+      free (p);
+      return NULL;
+    }
+  return p;
+}
+
+/* Adds a page at UPAGE to the current thread's address space
+   whose first READ_BYTES bytes are read from FILE at offset OFS
+   the first time it is accessed, and whose remaining bytes are
+   zeroed.  FILE must stay open as long as the page exists.
+
+   Two ELF segments may share a page.  If UPAGE is already in
+   use, the new bytes are merged into the existing page, which
+   becomes writable if either is.  Segments do not overlap, so of
+   two segments in a page the one whose bytes end first lies
+   entirely before the other.  Returns false if memory is short
+   or the file can't be read. */
+bool
+page_add_file (void *upage, struct file *file, off_t ofs,
+               size_t read_bytes, bool writable)
+{
+  struct page *p;
+  bool success;
+
+  ASSERT (read_bytes <= PGSIZE);
+
+  if (read_bytes == 0)
+    return page_add_zero (upage, writable);
+
+  lock_acquire (&page_lock);
+  p = find_page (upage);
+  if (p != NULL)
+    success = merge_file (p, file, ofs, read_bytes, writable);
+  else
+    {
+      p = add_page (upage, PAGE_FILE, writable);
+      if (p != NULL)
+        {
+          p->file = file;
+          p->file_ofs = ofs;
+          p->read_bytes = read_bytes;
+        }
+      success = p != NULL;
+    }
+  lock_release (&page_lock);
+  return success;
+}
+
+/* Adds a page at UPAGE to the current thread's address space
+   that is zeroed the first time it is accessed.  If UPAGE is
+   already in use, its zero bytes are already there, so the
+   existing page is kept and only made writable if WRITABLE is
+   true.  Returns false if memory is short. */
+bool
+page_add_zero (void *upage, bool writable)
+{
+  struct page *p;
+  bool success;
+
+  lock_acquire (&page_lock);
+  p = find_page (upage);
+  if (p != NULL)
+    success = merge_file (p, NULL, 0, 0, writable);
+  else
+    success = add_page (upage, PAGE_ZERO, writable) != NULL;
+  lock_release (&page_lock);
+  return success;
+}
+
+/* 把另一个段的内容合并到页P中：P的前READ_BYTES字节应来自FILE中
+   偏移OFS处，WRITABLE为真时P改为可写。P在内存中的内容已经延伸到
+   p->read_bytes字节处。如果新的段结束得更晚，它就在已有内容之后，
+   只读入延伸出的部分；否则它在已有内容之前，读入它的全部字节。
+   两段来自文件的同一位置时只需延长P，否则把P读入内存后再读入
+   新的段，之后P的内容只在内存或交换区中。调用者必须持有page_lock。 */
+static bool
+merge_file (struct page *p, struct file *file, off_t ofs,
+            size_t read_bytes, bool writable)
+{
+  uint32_t *pd = thread_current ()->pagedir;
+  uint8_t *kpage;
+  off_t want, got;
+
+  if (writable && !p->writable)
+    {
+      p->writable = true;
+      if (p->frame != NULL)
+        {
+          pagedir_clear_page (pd, p->upage);
+          pagedir_set_page (pd, p->upage, p->frame->kpage, true);
+        }
+    }
+  if (read_bytes == 0)
+    return true;
+
+  /* 还没读入内存，而且能用一段文件描述时，不必读入。 */
+  if (p->frame == NULL
+      && (p->type == PAGE_ZERO
+          || (p->type == PAGE_FILE && p->file == file
+              && p->file_ofs == ofs)))
+    {
+      p->type = PAGE_FILE;
+      p->file = file;
+      p->file_ofs = ofs;
+      if (read_bytes > p->read_bytes)
+        p->read_bytes = read_bytes;
+      return true;
+    }
+
+  if (p->frame == NULL && !load_page (p))
+    return false;
+  p->type = PAGE_SWAP;
+  kpage = p->frame->kpage;
+  if (read_bytes > p->read_bytes)
+    {
+      want = read_bytes - p->read_bytes;
+      got = file_read_at (file, kpage + p->read_bytes, want,
+                          ofs + p->read_bytes);
+      p->read_bytes = read_bytes;
+    }
+  else
+    {
+      want = read_bytes;
+      got = file_read_at (file, kpage, want, ofs);
+    }
+  return got == want;
+}
+
+/* 返回当前线程页表中UPAGE处的页，没有则返回NULL。 */
+static struct page *
+find_page (void *upage)
+{
+  struct page p;
+  struct hash_elem *e;
+
+  p.upage = upage;
+  e = hash_find (&thread_current ()->pages, &p.hash_elem);
+  return e != NULL ? hash_entry (e, struct page, hash_elem) : NULL;
+}
+
+/* 返回对ADDR的访问是否应当扩展栈：ADDR不低于用户栈指针ESP
+   以下32字节（PUSHA一次压入32字节），且在栈的最大范围内。 */
+static bool
+is_stack_access (const void *addr, const void *esp)
+{
+  return (esp != NULL
+          && (const uint8_t *) addr >= (const uint8_t *) esp - 32
+          && (const uint8_t *) addr >= (uint8_t *) PHYS_BASE - STACK_MAX
+          && is_user_vaddr (addr));
+}
+
+/* 把页P读入一个页框并映射到当前线程的地址空间。
+   调用者必须持有page_lock。 */
+static bool
+load_page (struct page *p)
+{
+  struct thread *t = thread_current ();
+  struct frame *f = frame_alloc (p);
+
+  if (f == NULL)
+    return false;
+
+  switch (p->type)
+    {
+    case PAGE_ZERO:
+      memset (f->kpage, 0, PGSIZE);
+      break;
+    case PAGE_FILE:
+      if (file_read_at (p->file, f->kpage, p->read_bytes, p->file_ofs)
+          != (off_t) p->read_bytes)
+        {
+          frame_free (f);
+          return false;
+        }
+      memset ((uint8_t *) f->kpage + p->read_bytes, 0,
+              PGSIZE - p->read_bytes);
+      break;
+    case PAGE_SWAP:
+      swap_in (p->swap_slot, f->kpage);
+      break;
+    default:
+      NOT_REACHED ();
+    }
+
+  if (!pagedir_set_page (t->pagedir, p->upage, f->kpage, p->writable))
+    {
+      frame_free (f);
+      return false;
+    }
+
+  /* 换入的页在内存中有了唯一的副本，交换槽可以释放了。
+     类型仍为PAGE_SWAP，再次换出时必须写回交换区。 */
+  if (p->type == PAGE_SWAP)
+    swap_free (p->swap_slot);
+  p->frame = f;
+  return true;
+}
+
+/* Brings the page containing ADDR, which the current thread
+   just faulted on, into memory.  If ADDR is not in any page of
+   the thread's address space but looks like a push onto the user
+   stack at ESP, adds a zeroed stack page there first.  ESP should
+   be null if the fault did not come from user code.  Returns true
+   if successful, false if ADDR is not a valid address or memory
+   is short. */
+bool
+page_in (void *addr, void *esp)
+{
+  void *upage = pg_round_down (addr);
+  struct page *p;
+  bool success;
+
+  lock_acquire (&page_lock);
+  p = find_page (upage);
+  if (p == NULL && is_stack_access (addr, esp))
+    p = add_page (upage, PAGE_ZERO, true);
+
+  if (p == NULL)
+    success = false;
+  else if (p->frame != NULL)
+    success = true;
+  else
+    success = load_page (p);
+  lock_release (&page_lock);
+  return success;
+}
+
+/* Unmaps page P, which is resident, from page directory PD,
+   writing it to swap first if its contents can't be recovered
+   from its source.  Afterward P's frame may be reused.  Returns
+   false, leaving P mapped, if P must be swapped out but there is
+   no free swap slot.  The caller must hold the page lock, as
+   frame_alloc()'s callers do. */
+bool
+page_out (struct page *p, uint32_t *pd)
+{
+  struct frame *f = p->frame;
+
+  ASSERT (lock_held_by_current_thread (&page_lock));
+  ASSERT (f != NULL);
+
+  /* 先取消映射再看脏位，这样之后的写入都会缺页并等待我们。 */
+  pagedir_clear_page (pd, p->upage);
+  if (pagedir_is_dirty (pd, p->upage) || p->type == PAGE_SWAP)
+    {
+      if (!swap_out (f->kpage, &p->swap_slot))
+        {
+          pagedir_set_page (pd, p->upage, f->kpage, p->writable);
+          pagedir_set_dirty (pd, p->upage, true);
+          return false;
+        }
+      p->type = PAGE_SWAP;
+    }
+  p->frame = NULL;
+  return true;
+}
+
+/* 销毁页P：释放它占用的页框或交换槽。 */
+static void
+destroy_page (struct hash_elem *e, void *aux UNUSED)
+{
+  struct page *p = hash_entry (e, struct page, hash_elem);
+
+  if (p->frame != NULL)
+    {
+      pagedir_clear_page (thread_current ()->pagedir, p->upage);
+      frame_free (p->frame);
+    }
+  else if (p->type == PAGE_SWAP)
+    swap_free (p->swap_slot);
+  free (p);
+}
+
+/* Returns a hash value for page P. */
+static unsigned
+page_hash (const struct hash_elem *p_, void *aux UNUSED)
+{
+  const struct page *p = hash_entry (p_, struct page, hash_elem);
+  return hash_bytes (&p->upage, sizeof p->upage);
+}
+
+/* Returns true if page A precedes page B. */
+static bool
+page_less (const struct hash_elem *a_, const struct hash_elem *b_,
+           void *aux UNUSED)
+{
+  const struct page *a = hash_entry (a_, struct page, hash_elem);
+  const struct page *b = hash_entry (b_, struct page, hash_elem);
+  return a->upage < b->upage;
+}
@@ -0,0 +1,49 @@
+#ifndef VM_PAGE_H
+#define VM_PAGE_H
+
+#include <hash.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "filesys/off_t.h"
+
+struct file;
+struct frame;
+
+/* Where a page's contents come from the next time it is brought
+   into memory. */
+enum page_type
+  {
+    PAGE_ZERO,                  /* Zero-filled. */
+    PAGE_FILE,                  /* Read from a file, rest zeroed. */
+    PAGE_SWAP                   /* Read back from a swap slot. */
+  };
+
+/* A page of a process's virtual address space, resident or not.
+   Kept in the owning thread's supplemental page table. */
+struct page
+  {
+    struct hash_elem hash_elem; /* Element in thread's pages. */
+    void *upage;                /* User virtual address. */
+    bool writable;              /* Writable by the process? */
+    enum page_type type;        /* Source of contents when not resident. */
+    struct frame *frame;        /* 所在的物理页框，不在内存时为NULL */
+
+    /* PAGE_FILE. */
+    struct file *file;          /* File to read from. */
+    off_t file_ofs;             /* Offset in FILE. */
+    size_t read_bytes;          /* Bytes to read; the rest is zeroed. */
+
+    /* PAGE_SWAP. */
+    size_t swap_slot;           /* 换出后所在的交换槽 */
+  };
+
+void page_init (void);
+bool page_table_init (void);
+void page_table_destroy (void);
+bool page_add_file (void *upage, struct file *, off_t ofs,
+                    size_t read_bytes, bool writable);
+bool page_add_zero (void *upage, bool writable);
+bool page_in (void *addr, void *esp);
+bool page_out (struct page *, uint32_t *pd);
+
+#endif /* vm/page.h */
@@ -0,0 +1,69 @@
+#include "vm/swap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <stdio.h>
+#include "devices/block.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Pages are swapped out to the block device in the BLOCK_SWAP
+   role, one page per slot of SECTORS_PER_SLOT consecutive
+   sectors. */
+#define SECTORS_PER_SLOT (PGSIZE / BLOCK_SECTOR_SIZE)
+
+static struct block *swap_device;   /* 交换设备，没有则为NULL */
+static struct bitmap *used_slots;   /* 已占用的交换槽 */
+static struct lock swap_lock;       /* 保护used_slots */
+
+/* Initializes the swap slots on the swap device, if there is
+   one.  Without a swap device, swap_out() always fails. */
+void
+swap_init (void)
+{
+  lock_init (&swap_lock);
+  swap_device = block_get_role (BLOCK_SWAP);
+  if (swap_device == NULL)
+    return;
+
+  used_slots = bitmap_create (block_size (swap_device) / SECTORS_PER_SLOT);
+  if (used_slots == NULL)
+    PANIC ("bitmap creation failed--swap device is too large");
+}
+
+/* Writes the page at KPAGE to a free swap slot and stores the
+   slot in *SLOT.  Returns false if there is no free slot. */
+bool
+swap_out (const void *kpage, size_t *slot)
+{
+  if (swap_device == NULL)
+    return false;
+
+  lock_acquire (&swap_lock);
+  *slot = bitmap_scan_and_flip (used_slots, 0, 1, false);
+  lock_release (&swap_lock);
+  if (*slot == BITMAP_ERROR)
+    return false;
+
+  block_write_multi (swap_device, *slot * SECTORS_PER_SLOT,
+                     SECTORS_PER_SLOT, kpage);
+  return true;
+}
+
+/* Reads the page in swap slot SLOT into KPAGE.  The slot stays
+   in use until freed with swap_free(). */
+void
+swap_in (size_t slot, void *kpage)
+{
+  block_read_multi (swap_device, slot * SECTORS_PER_SLOT,
+                    SECTORS_PER_SLOT, kpage);
+}
+
+/* Frees swap slot SLOT without reading it. */
+void
+swap_free (size_t slot)
+{
+  lock_acquire (&swap_lock);
+  ASSERT (bitmap_test (used_slots, slot));
+  bitmap_reset (used_slots, slot);
+  lock_release (&swap_lock);
+}